@@ -92,7 +92,7 @@ var card_form = function() {
 		$html_elem.find('input[name="id"]').attr("value", data["id"]);
 		$html_elem.find('input[name="title"]').attr("value", data["title"]);
 		$html_elem.find('textarea[name="question"]').text(data["question"]);
-		$html_elem.find('textarea[name="answer"]').text(data["answer"]);
+		$html_elem.find('textarea[name="answer"]').text(data["answer"] || "");
 		$html_elem.find('input[name="topic"]').attr("value", data["topic"]);
 	};
 
@@ -15,6 +15,9 @@ var card_list = function() {
 
 	var _topic_id = 0;
 
+	// Details of the listed cards by id, fetched with one request per page.
+	var _details = {};
+
 
 	//////////////////////////////////////////////////
 	// CRUD operations
@@ -38,6 +41,7 @@ var card_list = function() {
 
 				// Remove element from DOM.
 				$(`#cards-table tr[data-card-id="${id}"]`).remove();
+				delete _details[id];
 			}
 		});
 	};
@@ -63,6 +67,11 @@ var card_list = function() {
 	$("#contents").on("click", "#cards-table tr", function() {
 		if ($(this).find("td").length > 0) {	// ignore clicks on header
 			var id = $(this).find("td.id-td").text();
+			if (id in _details) {
+				card_form.set_data(_details[id]);
+				$("#contents").html(card_form.html());
+				return;
+			}
 			$.get("/api/v1/cards/" + id, function(data) {
 				card_form.set_data(data);
 				$("#contents").html(card_form.html());
@@ -70,6 +79,11 @@ var card_list = function() {
 		}
 	});
 
+	// Load the next page of cards when clicking the "More cards" button.
+	$("#contents").on("click", "#more-cards", function() {
+		load_cards($(this).attr("data-cursor"));
+	});
+
 	// Delete card when clicking the delete button.
 	$("#contents").on("click", "#cards-table button.card-delete", function() {
 		var id = $(this).parent().parent().find("td.id-td").text();
@@ -95,9 +109,14 @@ var card_list = function() {
 		$("#card-list-h1").text("Cards of topic " + topic_name);
 	};
 
-	// Load all cards into table.
-	var load_cards = function() {
+	// Load a page of cards into table, starting after the card with id
+	// after_id (or at the beginning if it's not given).
+	var load_cards = function(after_id) {
 		var url = "/api/v1/cards?topic_id=" + _topic_id;
+		if (after_id !== undefined)
+			url += "&after_id=" + after_id;
+		else
+			_details = {};
 		$.get(url, function(data) {
 			data.cards.forEach(function(card) {
 				$("#cards-table").append('<tr data-card-id="' + card.id + '">'
@@ -105,6 +124,21 @@ var card_list = function() {
 						+ "<td>" + card.title + "</td>"
 						+ '<td><button class="card-delete">Delete</button></td></tr>');
 			});
+
+			$("#more-cards").remove();
+			if (data.next_cursor !== null)
+				$("#cards-table").after('<button id="more-cards" data-cursor="'
+						+ data.next_cursor + '">More cards</button>');
+
+			// Prefetch the details of the whole page.
+			if (data.cards.length > 0) {
+				var ids = data.cards.map(function(card) { return card.id; });
+				$.get("/api/v1/cards?ids=" + ids.join(","), function(details) {
+					details.cards.forEach(function(card) {
+						_details[card.id] = card;
+					});
+				});
+			}
 		});
 	};
 
@@ -0,0 +1,513 @@
+//------------------------------------------------------------------------------
+//
+// Load generator for the nerd HTTP API.
+//
+// Starts an HttpServer on a temporary, seeded database and drives a mix of
+// card and topic requests over keep-alive connections. Reports throughput
+// and latency percentiles per request type.
+//
+// With --serialize, compares ways of turning a topic's card list into
+// JSON in-process instead, with --parse ways of reading a card from a
+// request body.
+//
+//------------------------------------------------------------------------------
+
+#include <algorithm>    // sort, max
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>      // EXIT_FAILURE, mkdtemp
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>   // mkdir
+#include <unistd.h>     // unlink, rmdir
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <json.hpp>
+
+#include "http_server.h"
+#include "names.h"
+#include "sqlite_connection_pool.h"
+#include "sqlite_database.h"
+#include "sqlite_statement.h"
+#include "sqlite_table.h"
+
+using namespace nerd;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum Op {
+    get_card,
+    list_cards,
+    list_topics,
+    create_card,
+    update_card,
+    delete_card,
+    n_ops
+};
+
+const char* const op_names[n_ops] = {
+    "get_card", "list_cards", "list_topics",
+    "create_card", "update_card", "delete_card"
+};
+
+struct Config {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int connections = 8;
+    int duration = 10;          // seconds
+    int topics = 10;
+    int cards = 10000;
+    int weights[n_ops] = {60, 15, 10, 5, 8, 2};
+    int serialize = 0;          // iterations of the serialization benchmark
+    int parse = 0;              // iterations of the parsing benchmark
+};
+
+// Latencies in nanoseconds, per operation.
+struct Stats {
+    std::vector<std::uint64_t> latencies[n_ops];
+    unsigned long errors[n_ops] = {};
+};
+
+void usage()
+{
+    std::cerr <<
+        "Usage: nerd_bench [<options>]\n" <<
+        "Options:\n" <<
+        "    --threads <n>       server worker threads (default: one per core)\n" <<
+        "    --connections <n>   concurrent keep-alive connections (default: 8)\n" <<
+        "    --duration <s>      seconds to run (default: 10)\n" <<
+        "    --topics <n>        topics to seed (default: 10)\n" <<
+        "    --cards <n>         cards to seed (default: 10000)\n" <<
+        "    --mix <op=w,...>    relative weights of the operations\n" <<
+        "                        (default: get_card=60,list_cards=15,list_topics=10,\n" <<
+        "                         create_card=5,update_card=8,delete_card=2)\n" <<
+        "    --serialize <n>     instead of the load test, serialize the cards of\n" <<
+        "                        topic 1 to JSON <n> times in every available way\n" <<
+        "    --parse <n>         instead of the load test, read a card from a request\n" <<
+        "                        body <n> times in every available way\n";
+}
+
+void parse_mix(const std::string& mix, Config& config)
+{
+    std::istringstream in(mix);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        auto pos = item.find('=');
+        const std::string name = item.substr(0, pos);
+        auto it = std::find_if(std::begin(op_names), std::end(op_names),
+                               [&name](const char* n) { return name == n; });
+        if (pos == std::string::npos || it == std::end(op_names))
+            throw std::invalid_argument("invalid mix entry: " + item);
+        config.weights[it - std::begin(op_names)] = std::stoi(item.substr(pos + 1));
+    }
+}
+
+// Create schema and test data, all in one transaction.
+void seed(const std::string& filename, const Config& config)
+{
+    SQLiteDatabase db{filename.c_str()};
+    db.init();
+
+    SQLiteStatement(db.data(), "BEGIN;").step();
+    TopicSQLiteTable topics(db);
+    Topic topic;
+    for (int i = 1; i <= config.topics; ++i) {
+        topic.name = "Topic " + std::to_string(i);
+        topics.insert(topic);
+    }
+    CardSQLiteTable cards(db);
+    Card card;
+    card.answer = std::string(200, 'a');
+    card.has_answer = true;
+    for (int i = 1; i <= config.cards; ++i) {
+        card.title = "Card " + std::to_string(i);
+        card.question = "What is the answer to question " + std::to_string(i) + "?";
+        card.topic = 1 + i % config.topics;
+        cards.insert(card);
+    }
+    SQLiteStatement(db.data(), "COMMIT;").step();
+}
+
+http::request<http::string_body> make_request(
+    http::verb method, const std::string& target, const std::string& body = "")
+{
+    http::request<http::string_body> req{method, target, 11};
+    req.set(http::field::host, "localhost");
+    req.keep_alive(true);
+    req.body() = body;
+    req.prepare_payload();
+    return req;
+}
+
+// Card list of topic 1 as JSON, with one json object per row
+// (the way cards were listed before typed rows).
+std::string list_with_dom(SQLiteDatabase& db)
+{
+    SQLiteStatement stmt(db.data(), db.statement_cache(),
+                         "SELECT id, title FROM card WHERE topic = 1 ORDER BY id;");
+    json cards = json::array();
+    while (stmt.step() == SQLITE_ROW) {
+        json card;
+        card["id"] = stmt.column_int(0);
+        card["title"] = std::string(stmt.column_text_view(1));
+        cards.push_back(card);
+    }
+    return cards.dump();
+}
+
+// Same with typed rows and their serializer.
+std::string list_with_structs(SQLiteDatabase& db)
+{
+    CardSQLiteTable table(db);
+    std::string out;
+    append_json_array(out, table.get({{"topic", "1"}}));
+    return out;
+}
+
+// Same without collecting the rows first (GET /api/v1/cards).
+std::string list_streamed(SQLiteDatabase& db)
+{
+    CardSQLiteTable table(db);
+    std::string out;
+    table.write_json(out, {{"topic", "1"}});
+    return out;
+}
+
+void run_serialize(const std::string& db_file, int iterations)
+{
+    SQLiteDatabase db{db_file.c_str()};
+    const struct {
+        const char* name;
+        std::string (*list)(SQLiteDatabase&);
+    } ways[] = {
+        {"dom", list_with_dom},
+        {"structs", list_with_structs},
+        {"streamed", list_streamed}
+    };
+
+    std::cout << "\n" << std::left << std::setw(14) << "way" << std::right
+              << std::setw(10) << "bytes" << std::setw(12) << "us/list" << "\n";
+    for (const auto& way : ways) {
+        const auto size = way.list(db).size();   // also warms the cache
+        auto start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            way.list(db);
+        auto elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start);
+        std::cout << std::left << std::setw(14) << way.name << std::right
+                  << std::setw(10) << size
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << elapsed.count() / iterations << "\n";
+    }
+}
+
+// Card from a request body through a json object, checked the way
+// request bodies were checked before JsonReader.
+void parse_with_dom(const std::string& body, Card& card)
+{
+    json data = json::parse(body);
+    if (data.find("title") == data.end() || data["title"] == ""
+        || data.find("question") == data.end() || data["question"] == "")
+        throw std::invalid_argument("invalid data");
+    card.title = data["title"].get<std::string>();
+    card.question = data["question"].get<std::string>();
+    card.has_answer = data.find("answer") != data.end();
+    if (card.has_answer)
+        card.answer = data["answer"].get<std::string>();
+    card.topic = data.find("topic") != data.end() ? data["topic"].get<int>() : 0;
+}
+
+// Same in one pass with JsonReader (PUT and POST /api/v1/cards).
+void parse_with_reader(const std::string& body, Card& card)
+{
+    parse_json(body, card);
+}
+
+void run_parse(int iterations)
+{
+    std::string body = R"({"title":"Card 1","question":"What is the answer to question 1?","answer":")";
+    body += std::string(200, 'a');
+    body += R"(\n\"quoted\" \u00e4","topic":1})";
+
+    const struct {
+        const char* name;
+        void (*parse)(const std::string&, Card&);
+    } ways[] = {
+        {"dom", parse_with_dom},
+        {"reader", parse_with_reader}
+    };
+
+    std::cout << "\n" << std::left << std::setw(14) << "way" << std::right
+              << std::setw(10) << "bytes" << std::setw(12) << "ns/card" << "\n";
+    for (const auto& way : ways) {
+        Card card;
+        auto start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            way.parse(body, card);
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start);
+        std::cout << std::left << std::setw(14) << way.name << std::right
+                  << std::setw(10) << body.size()
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << elapsed.count() / iterations << "\n";
+    }
+}
+
+// Send requests on a single connection until `deadline`.
+void run_client(unsigned short port, const Config& config, unsigned seed,
+                Clock::time_point deadline, Stats& stats)
+{
+    net::io_context ioc;
+    beast::tcp_stream stream(ioc);
+    stream.connect(tcp::endpoint(net::ip::make_address("127.0.0.1"), port));
+
+    std::mt19937 rng(seed);
+    std::discrete_distribution<int> pick_op(std::begin(config.weights),
+                                            std::end(config.weights));
+    std::uniform_int_distribution<int> pick_card(1, config.cards);
+    std::uniform_int_distribution<int> pick_topic(1, config.topics);
+
+    // Only cards created by this client are deleted, so the seeded
+    // cards can always be fetched.
+    std::vector<int> own_cards;
+    const std::string card_body =
+        R"({"title":"Bench card","question":"Bench question?","answer":"Bench answer","topic":1})";
+
+    beast::flat_buffer buffer;
+    while (Clock::now() < deadline) {
+        int op = pick_op(rng);
+        if (op == delete_card && own_cards.empty())
+            op = create_card;
+
+        http::request<http::string_body> req;
+        switch (op) {
+        case get_card:
+            req = make_request(http::verb::get,
+                               "/api/v1/cards/" + std::to_string(pick_card(rng)));
+            break;
+        case list_cards:
+            req = make_request(http::verb::get,
+                               "/api/v1/cards?topic_id=" + std::to_string(pick_topic(rng)));
+            break;
+        case list_topics:
+            req = make_request(http::verb::get, "/api/v1/topics");
+            break;
+        case create_card:
+            req = make_request(http::verb::post, "/api/v1/cards", card_body);
+            break;
+        case update_card:
+            req = make_request(http::verb::put,
+                               "/api/v1/cards/" + std::to_string(pick_card(rng)),
+                               card_body);
+            break;
+        case delete_card:
+            req = make_request(http::verb::delete_,
+                               "/api/v1/cards/" + std::to_string(own_cards.back()));
+            own_cards.pop_back();
+            break;
+        }
+
+        http::response<http::string_body> resp;
+        auto start = Clock::now();
+        http::write(stream, req);
+        http::read(stream, buffer, resp);
+        auto elapsed = Clock::now() - start;
+
+        stats.latencies[op].push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        if (resp.result() != http::status::ok) {
+            ++stats.errors[op];
+            continue;
+        }
+
+        // Failed mutations answer 200 with {"success":false,...}.
+        if (op == create_card || op == update_card || op == delete_card) {
+            json result = json::parse(resp.body(), nullptr, false);
+            if (result.is_discarded() || !result.is_object()
+                || (result.count("success") && result["success"] != true)) {
+                ++stats.errors[op];
+            } else if (op == create_card) {
+                if (result.count("id") && result["id"].is_number_integer())
+                    own_cards.push_back(result["id"]);
+                else
+                    ++stats.errors[op];
+            }
+        }
+    }
+
+    beast::error_code ec;
+    stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+}
+
+// Print one line of the report. `latencies` has to be sorted.
+void report(const char* name, const std::vector<std::uint64_t>& latencies,
+            unsigned long errors)
+{
+    auto percentile = [&latencies](double p) {
+        if (latencies.empty())
+            return 0.0;
+        auto i = static_cast<std::size_t>(p * (latencies.size() - 1));
+        return latencies[i] / 1000.0;
+    };
+    std::cout << std::left << std::setw(14) << name << std::right
+              << std::setw(10) << latencies.size()
+              << std::setw(8) << errors
+              << std::fixed << std::setprecision(1)
+              << std::setw(12) << percentile(0.5)
+              << std::setw(12) << percentile(0.99)
+              << std::setw(12) << percentile(0.999) << "\n";
+}
+
+// Serve the database and drive the configured request mix against it.
+void run_load(const std::string& db_file, const std::string& doc_root,
+              const Config& config)
+{
+    SQLiteConnectionPool pool{db_file, config.threads};
+    HttpServer server(pool, net::ip::make_address("127.0.0.1"), 0, doc_root,
+                      config.threads);
+    std::thread server_thread([&server] { server.run(); });
+
+    std::cout << "Running " << config.connections << " connections against "
+              << config.threads << " server threads for "
+              << config.duration << " s..." << std::endl;
+    std::vector<Stats> stats(config.connections);
+    std::vector<std::thread> clients;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::seconds(config.duration);
+    for (int i = 0; i < config.connections; ++i) {
+        clients.emplace_back([&, i] {
+            try {
+                run_client(server.port(), config, i + 1, deadline, stats[i]);
+            } catch (const std::exception& e) {
+                std::cerr << "client " << i << ": " << e.what() << std::endl;
+            }
+        });
+    }
+    for (auto& t : clients)
+        t.join();
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    server.stop();
+    server_thread.join();
+
+    // Merge and report.
+    std::cout << "\n" << std::left << std::setw(14) << "op" << std::right
+              << std::setw(10) << "requests" << std::setw(8) << "errors"
+              << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+              << std::setw(12) << "p999 us" << "\n";
+    std::vector<std::uint64_t> all;
+    unsigned long all_errors = 0;
+    for (int op = 0; op < n_ops; ++op) {
+        std::vector<std::uint64_t> latencies;
+        unsigned long errors = 0;
+        for (const auto& s : stats) {
+            latencies.insert(latencies.end(),
+                             s.latencies[op].begin(), s.latencies[op].end());
+            errors += s.errors[op];
+        }
+        if (latencies.empty())
+            continue;
+        std::sort(latencies.begin(), latencies.end());
+        report(op_names[op], latencies, errors);
+        all.insert(all.end(), latencies.begin(), latencies.end());
+        all_errors += errors;
+    }
+    std::sort(all.begin(), all.end());
+    report("all", all, all_errors);
+    std::cout << "\nthroughput: " << std::fixed << std::setprecision(0)
+              << all.size() / elapsed << " requests/s" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Config config;
+    try {
+        for (int i = 1; i < argc; i += 2) {
+            const std::string option(argv[i]);
+            if (i + 1 >= argc) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            const std::string value(argv[i + 1]);
+            if (option == "--threads")
+                config.threads = std::stoi(value);
+            else if (option == "--connections")
+                config.connections = std::stoi(value);
+            else if (option == "--duration")
+                config.duration = std::stoi(value);
+            else if (option == "--topics")
+                config.topics = std::stoi(value);
+            else if (option == "--cards")
+                config.cards = std::stoi(value);
+            else if (option == "--mix")
+                parse_mix(value, config);
+            else if (option == "--serialize")
+                config.serialize = std::stoi(value);
+            else if (option == "--parse")
+                config.parse = std::stoi(value);
+            else {
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+        if (config.threads < 1 || config.connections < 1 || config.duration < 1
+            || config.topics < 1 || config.cards < 1)
+            throw std::invalid_argument("all numbers have to be positive");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (config.parse > 0) {
+        std::cout << "Parsing a card " << config.parse << " times..." << std::endl;
+        run_parse(config.parse);
+        return 0;
+    }
+
+    char dir_template[] = "/tmp/nerd_bench.XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::cerr << "Error: cannot create temporary directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string dir(dir_template);
+    const std::string db_file = dir + "/nerdbase.db";
+    const std::string doc_root = dir + "/public";
+    mkdir(doc_root.c_str(), 0700);
+
+    int rc = 0;
+    try {
+        std::cout << "Seeding " << config.topics << " topics and "
+                  << config.cards << " cards..." << std::endl;
+        seed(db_file, config);
+
+        if (config.serialize > 0) {
+            std::cout << "Serializing the " << (config.cards / config.topics)
+                      << " cards of a topic " << config.serialize << " times..." << std::endl;
+            run_serialize(db_file, config.serialize);
+        } else {
+            run_load(db_file, doc_root, config);
+        }
+
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        rc = EXIT_FAILURE;
+    }
+
+    for (const char* suffix : {"", "-wal", "-shm"})
+        unlink((db_file + suffix).c_str());
+    rmdir(doc_root.c_str());
+    rmdir(dir.c_str());
+    return rc;
+}
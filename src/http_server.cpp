@@ -1,49 +1,117 @@
+#include <algorithm>    // min
+#include <cstdint>
+#include <cstdio>       // snprintf
+#include <exception>
 #include <iostream>
-#include <regex>
-#include <string>   // string, stoi
+#include <memory>   // enable_shared_from_this, make_shared
+#include <random>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/optional.hpp>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <cerrno>
+#endif
 
 #include <json.hpp>
 
 #include "http_server.h"
+#include "metrics.h"
 #include "names.h"
+#include "request_arena.h"
+#include "router.h"
+#include "rows.h"
+#include "sqlite_database.h"
+#include "sqlite_export.h"
 #include "sqlite_table.h"
+#include "sqlite_write_queue.h"
+#include "static_file_cache.h"
+
+namespace nerd {
 
-namespace {
+constexpr std::size_t HttpServer::max_request_body_size;
+constexpr std::chrono::microseconds HttpServer::max_write_delay;
 
-// Wrapper for std::regex_match for string_views.
-bool sv_regex_match(
-    const beast::string_view& sv,
-    std::match_results<beast::string_view::const_iterator>& matches,
-    const std::regex& r)
+void HttpServer::run()
 {
-    return std::regex_match(sv.begin(), sv.end(), matches, r);
+    do_accept();
+
+    // An exception escaping a handler is logged, and the worker
+    // goes on with the next handler.
+    auto work = [this] {
+        for (;;) {
+            try {
+                m_ioctx.run();
+                return;
+            } catch (const std::exception& e) {
+                std::cerr << "Error in handler: " << e.what() << std::endl;
+            }
+        }
+    };
+
+    // The calling thread is one of the workers.
+    std::vector<std::thread> workers;
+    workers.reserve(m_threads - 1);
+    for (int i = 1; i < m_threads; ++i)
+        workers.emplace_back(work);
+    work();
+
+    for (auto& t : workers)
+        t.join();
 }
 
+void HttpServer::stop()
+{
+    m_ioctx.stop();
 }
 
-namespace nerd {
+unsigned short HttpServer::port() const
+{
+    return m_acceptor.local_endpoint().port();
+}
 
-void HttpServer::run()
+void HttpServer::add_routes()
 {
-    for(;;) {
-        // This will receive the new connection
-        tcp::socket socket{m_ioctx};
-
-        // Block until we get a connection
-        m_acceptor.accept(socket);
-
-        // Launch the session, transferring ownership of the socket
-        std::thread{std::bind(
-                &HttpServer::do_session,
-                this,           // shared_ptr?
-                std::move(socket))}.detach();
-    }
+    auto add = [this](http::verb method, beast::string_view pattern, Route route) {
+        m_router.add(method, pattern, static_cast<int>(route));
+    };
+
+    add(http::verb::get,     "/api/v1/cards/{id}", Route::card_get);
+    add(http::verb::put,     "/api/v1/cards/{id}", Route::card_update);
+    add(http::verb::delete_, "/api/v1/cards/{id}", Route::card_delete);
+    add(http::verb::get,     "/api/v1/cards", Route::cards_get);
+    add(http::verb::post,    "/api/v1/cards", Route::card_create);
+    add(http::verb::post,    "/api/v1/cards/bulk", Route::cards_import);
+    add(http::verb::get,     "/api/v1/cards/search", Route::cards_search);
+    add(http::verb::post,    "/api/v1/cards/lookup", Route::cards_lookup);
+
+    add(http::verb::put,     "/api/v1/topics/{id}", Route::topic_update);
+    add(http::verb::delete_, "/api/v1/topics/{id}", Route::topic_delete);
+    add(http::verb::post,    "/api/v1/topics", Route::topic_create);
+    add(http::verb::get,     "/api/v1/topics", Route::topics_get);
+
+    add(http::verb::get,     "/api/v1/export", Route::export_all);
+
+    add(http::verb::get,     "/metrics", Route::metrics);
+
+    // Label names in the order of Route.
+    Metrics::instance().set_routes({
+        "card_get", "card_update", "card_delete", "cards_get", "card_create",
+        "cards_import", "cards_search", "cards_lookup",
+        "topic_update", "topic_delete", "topic_create", "topics_get", "export",
+        "metrics", "static_file", "other"
+    });
 }
 
 
@@ -56,50 +124,69 @@ http::response<http::string_body> HttpServer::build_json_response(
     const http::request<Body, http::basic_fields<Allocator>>& req,
     const json& response_json)
 {
-    std::string body = response_json.dump();
+    return build_json_response(req, response_json.dump());
+}
+
+template<class Body, class Allocator>
+http::response<http::string_body> HttpServer::build_json_response(
+    const http::request<Body, http::basic_fields<Allocator>>& req,
+    std::string&& body)
+{
+    return build_json_response(req.version(), req.keep_alive(), std::move(body));
+}
+
+http::response<http::string_body> HttpServer::build_json_response(
+    unsigned version, bool keep_alive, std::string&& body)
+{
+    const auto size = body.size();
     http::response<http::string_body> resp(
         http::status::ok,
-        req.version(),
-        body);
+        version,
+        std::move(body));
     resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     resp.set(http::field::content_type, "application/json");
-    resp.content_length(body.size());
-    resp.keep_alive(req.keep_alive());
-    return std::move(resp);
+    resp.content_length(size);
+    resp.keep_alive(keep_alive);
+    return resp;
 }
 
-beast::string_view HttpServer::mime_type(beast::string_view path)
+bool HttpServer::etag_matches(beast::string_view if_none_match,
+                              beast::string_view etag)
 {
-    using beast::iequals;
-    auto const ext = [&path]
-    {
-        auto const pos = path.rfind(".");
+    // Weak comparison of every entity tag in the list, see RFC 7232.
+    while (!if_none_match.empty()) {
+        auto pos = if_none_match.find(',');
+        auto candidate = if_none_match.substr(0, pos);
+        while (!candidate.empty() && candidate.front() == ' ')
+            candidate.remove_prefix(1);
+        while (!candidate.empty() && candidate.back() == ' ')
+            candidate.remove_suffix(1);
+        if (candidate == "*")
+            return true;
+        if (candidate.starts_with("W/"))
+            candidate.remove_prefix(2);
+        if (candidate == etag)
+            return true;
         if (pos == beast::string_view::npos)
-            return beast::string_view{};
-        return path.substr(pos);
+            break;
+        if_none_match.remove_prefix(pos + 1);
+    }
+    return false;
+}
+
+std::string HttpServer::api_etag(char table, unsigned long version)
+{
+    // Versions restart with every process, so a random nonce of the
+    // process is part of the tag to avoid matching tags of an earlier
+    // run, even one started within the same second.
+    static const std::string nonce = [] {
+        std::random_device rd;
+        const std::uint64_t n = (std::uint64_t(rd()) << 32) ^ rd();
+        char buf[17];
+        std::snprintf(buf, sizeof buf, "%016llx", static_cast<unsigned long long>(n));
+        return std::string(buf);
     }();
-    if (iequals(ext, ".htm"))  return "text/html";
-    if (iequals(ext, ".html")) return "text/html";
-    if (iequals(ext, ".php"))  return "text/html";
-    if (iequals(ext, ".css"))  return "text/css";
-    if (iequals(ext, ".txt"))  return "text/plain";
-    if (iequals(ext, ".js"))   return "application/javascript";
-    if (iequals(ext, ".json")) return "application/json";
-    if (iequals(ext, ".xml"))  return "application/xml";
-    if (iequals(ext, ".swf"))  return "application/x-shockwave-flash";
-    if (iequals(ext, ".flv"))  return "video/x-flv";
-    if (iequals(ext, ".png"))  return "image/png";
-    if (iequals(ext, ".jpe"))  return "image/jpeg";
-    if (iequals(ext, ".jpeg")) return "image/jpeg";
-    if (iequals(ext, ".jpg"))  return "image/jpeg";
-    if (iequals(ext, ".gif"))  return "image/gif";
-    if (iequals(ext, ".bmp"))  return "image/bmp";
-    if (iequals(ext, ".ico"))  return "image/vnd.microsoft.icon";
-    if (iequals(ext, ".tiff")) return "image/tiff";
-    if (iequals(ext, ".tif"))  return "image/tiff";
-    if (iequals(ext, ".svg"))  return "image/svg+xml";
-    if (iequals(ext, ".svgz")) return "image/svg+xml";
-    return "application/text";
+    return '"' + std::string(1, table) + nonce + '.' + std::to_string(version) + '"';
 }
 
 void HttpServer::fail(beast::error_code ec, char const* what)
@@ -136,51 +223,351 @@ std::string HttpServer::path_cat(
 
 
 //////////////////////////////
-// Non-static functions
+// Session
 //////////////////////////////
 
-void HttpServer::do_session(tcp::socket& socket)
-{
-    bool close = false;
-    beast::error_code ec;
+class HttpServer::Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(HttpServer& server, tcp::socket&& socket)
+    : m_server(server)
+    , m_stream(std::move(socket))
+    {
+        Metrics::instance().connection_opened();
+    }
+
+    ~Session()
+    {
+        Metrics::instance().connection_closed();
+    }
+
+    void run()
+    {
+        // Start reading on the session's strand.
+        net::dispatch(m_stream.get_executor(),
+                      beast::bind_front_handler(&Session::do_read,
+                                                shared_from_this()));
+    }
+
+private:
+    // This is the C++11 equivalent of a generic lambda.
+    // The function object is used to send an HTTP message. It may be
+    // called from any thread (the write queue completes requests on
+    // its own), so the write is started on the session's strand.
+    struct send_lambda {
+        std::shared_ptr<Session> self_;
+
+        explicit send_lambda(std::shared_ptr<Session> self)
+            : self_(std::move(self))
+        {
+        }
+
+        template<bool isRequest, class Body, class Fields>
+        void
+        operator()(http::message<isRequest, Body, Fields>&& msg) const
+        {
+            // The lifetime of the message has to extend
+            // for the duration of the async operation so
+            // we use a shared_ptr to manage it.
+            auto sp = std::make_shared<
+                http::message<isRequest, Body, Fields>>(std::move(msg));
+
+            auto self = self_;
+            net::dispatch(self->m_stream.get_executor(), [self, sp] {
+                // Store a type-erased version of the shared
+                // pointer in the class to keep it alive.
+                self->m_res = sp;
 
-    // This buffer is required to persist across reads
-    beast::flat_buffer buffer;
+                http::async_write(
+                    self->m_stream,
+                    *sp,
+                    beast::bind_front_handler(
+                        &Session::on_write,
+                        self,
+                        sp->need_eof()));
+            });
+        }
+
+#ifdef __linux__
+        // Files go from the page cache to the socket with sendfile()
+        // after the header is written; see do_sendfile().
+        void
+        operator()(http::response<FileRangeBody>&& msg) const
+        {
+            auto sp = std::make_shared<FileResponse>(std::move(msg));
+
+            auto self = self_;
+            net::dispatch(self->m_stream.get_executor(), [self, sp] {
+                self->m_res = sp;
+
+                http::async_write_header(
+                    self->m_stream,
+                    sp->serializer,
+                    beast::bind_front_handler(
+                        &Session::on_write_file_header,
+                        self,
+                        sp));
+            });
+        }
+#endif
+    };
+
+#ifdef __linux__
+    // A file response being sent with sendfile().
+    struct FileResponse {
+        explicit FileResponse(http::response<FileRangeBody>&& msg)
+            : message(std::move(msg))
+            , serializer(message)
+            , offset(message.body().offset)
+            , remaining(message.body().size)
+        {
+        }
+
+        http::response<FileRangeBody> message;
+        http::response_serializer<FileRangeBody> serializer;
+        std::uint64_t offset;       // next byte of the file to send
+        std::uint64_t remaining;
+    };
+
+    void on_write_file_header(std::shared_ptr<FileResponse> sp,
+                              beast::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+            return on_write(sp->message.need_eof(), ec, bytes_transferred);
+        Metrics::instance().record_bytes(0, bytes_transferred);
+        do_sendfile(std::move(sp), 0);
+    }
+
+    // Send the rest of the file without copying it to user space, one
+    // chunk per call. When the socket buffer is full, wait until the
+    // socket is writable again. Falls back to writing the body through
+    // the serializer if the file doesn't support sendfile().
+    void do_sendfile(std::shared_ptr<FileResponse> sp, std::size_t sent)
+    {
+        // Don't block the worker thread in sendfile().
+        auto& socket = m_stream.socket();
+        beast::error_code ec;
+        socket.native_non_blocking(true, ec);
 
-    // This lambda is used to send messages
-    send_lambda<tcp::socket> lambda{socket, close, ec};
+        const int file = sp->message.body().file.native_handle();
+        while (!ec && sp->remaining > 0) {
+            off_t offset = sp->offset;
+            const auto n = ::sendfile(
+                socket.native_handle(), file, &offset,
+                std::min<std::uint64_t>(sp->remaining, max_sendfile_chunk));
+            if (n > 0) {
+                sp->offset += n;
+                sp->remaining -= n;
+                sent += n;
+                // Queue the next chunk behind the handlers that are
+                // already waiting, so other connections get their turn.
+                if (sp->remaining > 0)
+                    return net::post(
+                        m_stream.get_executor(),
+                        beast::bind_front_handler(&Session::do_sendfile,
+                                                  shared_from_this(), sp, sent));
+            } else if (n == 0) {
+                ec = http::error::short_read;   // file got shorter
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return socket.async_wait(
+                    tcp::socket::wait_write,
+                    beast::bind_front_handler(&Session::on_sendfile_writable,
+                                              shared_from_this(), sp, sent));
+            } else if ((errno == EINVAL || errno == ENOSYS) && sent == 0) {
+                return http::async_write(
+                    m_stream, sp->serializer,
+                    beast::bind_front_handler(&Session::on_write,
+                                              shared_from_this(),
+                                              sp->message.need_eof()));
+            } else if (errno != EINTR) {
+                ec.assign(errno, beast::system_category());
+            }
+        }
+        on_write(sp->message.need_eof(), ec, sent);
+    }
 
-    for(;;) {
-        // Read a request
-        http::request<http::string_body> req;
-        http::read(socket, buffer, req, ec);
+    void on_sendfile_writable(std::shared_ptr<FileResponse> sp, std::size_t sent,
+                              beast::error_code ec)
+    {
+        if (ec)
+            return on_write(sp->message.need_eof(), ec, sent);
+        do_sendfile(std::move(sp), sent);
+    }
+#endif
+
+    void do_read()
+    {
+        // A new parser for every request, otherwise the
+        // operation behavior is undefined. The previous request
+        // is gone, so its memory can be reused.
+        m_parser.reset();
+        m_arena.reset();
+        ArenaAllocator<char> alloc(m_arena);
+        m_parser.emplace(std::piecewise_construct,
+                         std::make_tuple(alloc), std::make_tuple(alloc));
+        m_parser->body_limit(max_request_body_size);
+
+        http::async_read(m_stream, m_buffer, *m_parser,
+                         beast::bind_front_handler(&Session::on_read,
+                                                   shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        Metrics::instance().record_bytes(bytes_transferred, 0);
+        // This means they closed the connection
         if (ec == http::error::end_of_stream)
-            break;
+            return do_close();
         if (ec)
             return fail(ec, "read");
+        Metrics::instance().record_request_allocations(
+            m_arena.allocations(), m_arena.bytes(), m_arena.heap_allocations());
+
+        // Send the response. A handler that throws fails only its request;
+        // the connection is closed after the error response.
+        const unsigned version = m_parser->get().version();
+        try {
+            m_server.handle_request(m_parser->release(), send_lambda(shared_from_this()));
+        } catch (const std::exception& e) {
+            send_lambda send(shared_from_this());
+            send(server_error(version, e.what()));
+        }
+    }
 
-        // Send the response
-        handle_request(std::move(req), lambda);
+    static http::response<http::string_body>
+    server_error(unsigned version, beast::string_view what)
+    {
+        http::response<http::string_body> resp{http::status::internal_server_error, version};
+        resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        resp.set(http::field::content_type, "text/html");
+        resp.keep_alive(false);
+        resp.body() = "An error occurred: '" + std::string(what) + "'";
+        resp.prepare_payload();
+        return resp;
+    }
+
+    void on_write(bool close, beast::error_code ec, std::size_t bytes_transferred)
+    {
+        Metrics::instance().record_bytes(0, bytes_transferred);
         if (ec)
             return fail(ec, "write");
         if (close) {
             // This means we should close the connection, usually because
             // the response indicated the "Connection: close" semantic.
-            break;
+            return do_close();
         }
+
+        // We're done with the response so delete it
+        m_res = nullptr;
+
+        do_read();
+    }
+
+    void do_close()
+    {
+        // Send a TCP shutdown
+        beast::error_code ec;
+        m_stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+
+        // At this point the connection is closed gracefully
     }
 
-    // Send a TCP shutdown
-    socket.shutdown(tcp::socket::shutdown_send, ec);
+    HttpServer& m_server;
+    beast::tcp_stream m_stream;
+    beast::flat_buffer m_buffer;     // has to persist across reads
+    RequestArena m_arena;            // memory of the request being read
+    boost::optional<ArenaRequestParser> m_parser;
+    std::shared_ptr<void> m_res;
+
+    // Largest sendfile() call; see do_sendfile().
+    static constexpr std::size_t max_sendfile_chunk = 1 << 20;
+};
+
+constexpr std::size_t HttpServer::Session::max_sendfile_chunk;
+
+
+//////////////////////////////
+// Non-static functions
+//////////////////////////////
 
-    // At this point the connection is closed gracefully
+void HttpServer::do_accept()
+{
+    // Each connection gets its own strand, so its handlers never
+    // run concurrently even with several worker threads.
+    m_acceptor.async_accept(
+        net::make_strand(m_ioctx),
+        beast::bind_front_handler(&HttpServer::on_accept, this));
+}
+
+void HttpServer::on_accept(beast::error_code ec, tcp::socket socket)
+{
+    if (ec)
+        fail(ec, "accept");
+    else
+        std::make_shared<Session>(*this, std::move(socket))->run();
+
+    // Accept another connection
+    do_accept();
+}
+
+template<class Body, class Allocator>
+http::response<http::string_body> HttpServer::cards_response(
+    const http::request<Body, http::basic_fields<Allocator>>& req,
+    const std::vector<int>& ids)
+{
+    auto db = m_pool.reader();
+    CardSQLiteTable table(*db);
+    std::string body = R"({"cards":)";
+    table.get_many_json(body, ids);
+    body += '}';
+    return build_json_response(req, std::move(body));
+}
+
+template<class Body, class Allocator, class Send>
+void HttpServer::write(
+    const http::request<Body, http::basic_fields<Allocator>>& req,
+    const Send& send,
+    std::function<void(SQLiteDatabase&, json&)> mutation)
+{
+    // The request is gone when the batch is committed.
+    const unsigned version = req.version();
+    const bool keep_alive = req.keep_alive();
+    auto result = std::make_shared<json>();
+
+    m_writes.submit(
+        [result, mutation](SQLiteDatabase& db) {
+            mutation(db, *result);
+        },
+        [result, send, version, keep_alive](std::exception_ptr error) {
+            json& resp_json = *result;
+            if (error) {
+                resp_json = json::object();
+                resp_json["success"] = false;
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception& e) {
+                    resp_json["error_msg"] = e.what();
+                } catch (...) {
+                    resp_json["error_msg"] = "unknown error";
+                }
+            } else if (resp_json.is_null()) {
+                resp_json["success"] = true;
+            }
+            send(build_json_response(version, keep_alive, resp_json.dump()));
+        });
 }
 
+
 template<class Body, class Allocator, class Send>
 void HttpServer::handle_request(
     http::request<Body, http::basic_fields<Allocator>> req,
-    Send&& send)
+    Send&& send_response)
 {
+    // Every response is counted under the route that handled the request.
+    metered_send<typename std::decay<Send>::type> send{
+        std::forward<Send>(send_response), Route::other,
+        std::chrono::steady_clock::now()};
+    Route& route = send.route_;
+
     // Returns a bad request response
     auto const bad_request =
         [&req](beast::string_view why)
@@ -218,147 +605,319 @@ void HttpServer::handle_request(
         return resp;
     };
 
+    // Returns a not modified response for a matching If-None-Match
+    auto const not_modified = [&req](beast::string_view etag)
+    {
+        http::response<http::empty_body> resp{http::status::not_modified, req.version()};
+        resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        resp.set(http::field::etag, etag);
+        resp.set(http::field::cache_control, "no-cache");
+        resp.keep_alive(req.keep_alive());
+        return resp;
+    };
+
     // API TODO:
     // - Check Content-type field.
     // - Send error response instead of just throwing.
     // - Create api_success and api_error functions for uniform responses.
     // - Error checking for json parsing.
-    ////
-    // Card API
-    ////
-    {
-        const std::regex regex(R"(/api/v1/cards/(\d+))");
-        std::match_results<beast::string_view::const_iterator> matches;
-        if (sv_regex_match(req.target(), matches, regex)) {
-            int card_id = std::stoi(matches[1]);
-            if (req.method() == http::verb::get) {          // get card
-                CardSQLiteTable table(m_db.data());
-                json card_json = table.get_one(card_id);
-                auto resp = build_json_response(req, card_json);
-                return send(std::move(resp));
-            } else if (req.method() == http::verb::put) {   // update card
-                json resp_json;
-                try {
-                    json req_json = json::parse(req.body());
-                    CardSQLiteTable table(m_db.data());
-                    table.update(card_id, req_json);
-                    resp_json["success"] = true;
-                } catch (const std::exception& e) {
-                    resp_json["success"] = false;
-                    resp_json["error_msg"] = e.what();
-                }
-                auto resp = build_json_response(req, resp_json);
-                return send(std::move(resp));
-            } else if (req.method() == http::verb::delete_) {   // delete card
-                json resp_json;
-                try {
-                    CardSQLiteTable table(m_db.data());
-                    table.remove(card_id);
-                    resp_json["success"] = true;
-                } catch (const std::exception& e) {
-                    resp_json["success"] = false;
-                    resp_json["error_msg"] = e.what();
+    Router::Match match;
+    if (m_router.match(req.method(), req.target(), match)) {
+        route = static_cast<Route>(match.route);
+        switch (route) {
+        ////
+        // Card API
+        ////
+        case Route::card_get: {
+            // The version has to be read before the data.
+            auto etag = api_etag('c', CardSQLiteTable::version());
+            if (etag_matches(req[http::field::if_none_match], etag))
+                return send(not_modified(etag));
+            auto db = m_pool.reader();
+            CardSQLiteTable table(*db);
+            std::string body;
+            try {
+                append_json(body, table.get_one(match.params[0]));
+            } catch (const std::out_of_range&) {
+                return send(not_found(req.target()));
+            }
+            auto resp = build_json_response(req, std::move(body));
+            resp.set(http::field::etag, etag);
+            resp.set(http::field::cache_control, "no-cache");
+            return send(std::move(resp));
+        }
+        case Route::card_update: {
+            Card card;
+            try {
+                parse_json(req.body(), card);
+            } catch (const std::exception& e) {
+                return send(build_json_response(
+                    req, json{{"success", false}, {"error_msg", e.what()}}));
+            }
+            const int id = match.params[0];
+            return write(req, send, [id, card](SQLiteDatabase& db, json&) {
+                CardSQLiteTable table(db);
+                table.update(id, card);
+            });
+        }
+        case Route::card_delete: {
+            const int id = match.params[0];
+            return write(req, send, [id](SQLiteDatabase& db, json&) {
+                CardSQLiteTable table(db);
+                table.remove(id);
+            });
+        }
+        case Route::cards_get: {
+            auto ids_param = query_param(match.query, "ids");
+            if (!ids_param.empty()) {
+                // Multi-get: ids=1,2,3
+                std::string ids_str;
+                std::vector<int> ids;
+                if (!percent_decode(ids_param, ids_str))
+                    return send(bad_request("Invalid ids"));
+                beast::string_view rest = ids_str;
+                while (true) {
+                    auto pos = rest.find(',');
+                    int id;
+                    if (!parse_id(rest.substr(0, pos), id) || ids.size() == max_page_size)
+                        return send(bad_request("Invalid ids"));
+                    ids.push_back(id);
+                    if (pos == beast::string_view::npos)
+                        break;
+                    rest.remove_prefix(pos + 1);
                 }
-                auto resp = build_json_response(req, resp_json);
+
+                auto etag = api_etag('c', CardSQLiteTable::version());
+                if (etag_matches(req[http::field::if_none_match], etag))
+                    return send(not_modified(etag));
+                auto resp = cards_response(req, ids);
+                resp.set(http::field::etag, etag);
+                resp.set(http::field::cache_control, "no-cache");
                 return send(std::move(resp));
-            } else {
-                return send(bad_request("Invalid HTTP-method"));
             }
+
+            int topic_id;
+            if (!parse_id(query_param(match.query, "topic_id"), topic_id))
+                return send(bad_request("Missing or invalid topic_id"));
+
+            // Keyset pagination: the page starts after the card with id
+            // "after_id"; "next_cursor" is the after_id of the next page.
+            int after_id = 0;
+            auto after = query_param(match.query, "after_id");
+            if (!after.empty() && !parse_id(after, after_id))
+                return send(bad_request("Invalid after_id"));
+            int limit = default_page_size;
+            auto limit_str = query_param(match.query, "limit");
+            if (!limit_str.empty()
+                && (!parse_id(limit_str, limit) || limit < 1 || limit > max_page_size))
+                return send(bad_request("Invalid limit"));
+
+            auto etag = api_etag('c', CardSQLiteTable::version());
+            if (etag_matches(req[http::field::if_none_match], etag))
+                return send(not_modified(etag));
+            auto db = m_pool.reader();
+            CardSQLiteTable table(*db);
+            std::unordered_map<std::string, std::string> filter = {
+                {"topic", std::to_string(topic_id)},
+                {"after_id", std::to_string(after_id)}
+            };
+            std::string body = R"({"cards":)";
+            int next = table.write_json(body, filter, limit);
+            body += R"(,"next_cursor":)";
+            body += next < 0 ? "null" : std::to_string(next);
+            body += '}';
+            auto resp = build_json_response(req, std::move(body));
+            resp.set(http::field::etag, etag);
+            resp.set(http::field::cache_control, "no-cache");
+            return send(std::move(resp));
         }
-    }
-    {
-        const std::regex regex(R"(/api/v1/cards\?topic_id=(\d+))");
-        std::match_results<beast::string_view::const_iterator> matches;
-        if (sv_regex_match(req.target(), matches, regex)) {
-            int topic_id = std::stoi(matches[1]);
-            if (req.method() == http::verb::get) {
-                CardSQLiteTable table(m_db.data());
-                std::unordered_map<std::string, std::string> filter = {
-                    {"topic", std::to_string(topic_id)}
-                };
-                json cards_json = {{"cards", table.get(filter)}};
-                auto resp = build_json_response(req, cards_json);
-                return send(std::move(resp));
-            } else {
-                return send(bad_request("Invalid HTTP-method"));
+        case Route::cards_import: {
+            // Shared, so the (possibly large) list isn't copied into the queue.
+            auto cards = std::make_shared<std::vector<Card>>();
+            try {
+                parse_json_list(req.body(), *cards);
+            } catch (const std::exception& e) {
+                return send(build_json_response(
+                    req, json{{"success", false}, {"error_msg", e.what()}}));
             }
+            return write(req, send, [cards](SQLiteDatabase& db, json& result) {
+                CardSQLiteTable table(db);
+                auto ids = table.insert_many(*cards);
+                result["first_id"] = ids.first;
+                result["last_id"] = ids.second;
+                result["count"] = cards->size();
+            });
         }
-    }
-    {
-        if (req.target().compare("/api/v1/cards") == 0) {
-            if (req.method() == http::verb::post) {
-                json card_json = json::parse(req.body());
-                CardSQLiteTable table(m_db.data());
-                int id = table.insert(card_json);
-                json id_json = {{"id", id}};
-                auto resp = build_json_response(req, id_json);
-                return send(std::move(resp));
-            } else {
-                return send(bad_request("Invalid HTTP-method"));
+        case Route::cards_search: {
+            std::string terms;
+            if (!percent_decode(query_param(match.query, "q"), terms))
+                return send(bad_request("Invalid q"));
+            int limit = default_page_size;
+            auto limit_str = query_param(match.query, "limit");
+            if (!limit_str.empty()
+                && (!parse_id(limit_str, limit) || limit < 1 || limit > max_page_size))
+                return send(bad_request("Invalid limit"));
+            int offset = 0;
+            auto offset_str = query_param(match.query, "offset");
+            if (!offset_str.empty() && !parse_id(offset_str, offset))
+                return send(bad_request("Invalid offset"));
+
+            auto etag = api_etag('c', CardSQLiteTable::version());
+            if (etag_matches(req[http::field::if_none_match], etag))
+                return send(not_modified(etag));
+            auto db = m_pool.reader();
+            CardSQLiteTable table(*db);
+            std::string body = R"({"cards":)";
+            bool more;
+            try {
+                more = table.search_json(body, terms, limit, offset);
+            } catch (const std::invalid_argument& e) {
+                return send(bad_request(e.what()));
             }
-        } 
-    }
-    ////
-    // Topic API
-    ////
-    {
-        const std::regex regex(R"(/api/v1/topics/(\d+))");
-        std::match_results<beast::string_view::const_iterator> matches;
-        if (sv_regex_match(req.target(), matches, regex)) {
-            int topic_id = std::stoi(matches[1]);
-            if (req.method() == http::verb::put) {   // update topic
-                json resp_json;
-                try {
-                    json req_json = json::parse(req.body());
-                    TopicSQLiteTable table(m_db.data());
-                    table.update(topic_id, req_json);
-                    resp_json["success"] = true;
-                } catch (const std::exception& e) {
-                    resp_json["success"] = false;
-                    resp_json["error_msg"] = e.what();
-                }
-                auto resp = build_json_response(req, resp_json);
-                return send(std::move(resp));
-            } else if (req.method() == http::verb::delete_) {   // delete topic
-                json resp_json;
-                try {
-                    TopicSQLiteTable table(m_db.data());
-                    table.remove(topic_id);
-                    resp_json["success"] = true;
-                } catch (const std::exception& e) {
-                    resp_json["success"] = false;
-                    resp_json["error_msg"] = e.what();
-                }
-                auto resp = build_json_response(req, resp_json);
-                return send(std::move(resp));
-            } else {
-                return send(bad_request("Invalid HTTP-method"));
+            body += R"(,"next_offset":)";
+            body += more ? std::to_string(offset + limit) : "null";
+            body += '}';
+            auto resp = build_json_response(req, std::move(body));
+            resp.set(http::field::etag, etag);
+            resp.set(http::field::cache_control, "no-cache");
+            return send(std::move(resp));
+        }
+        case Route::cards_lookup: {
+            // Multi-get for lists too long for a URL: {"ids":[1,2,3]}
+            std::vector<int> ids;
+            try {
+                json req_json = json::parse(req.body().begin(), req.body().end());
+                ids = req_json.at("ids").get<std::vector<int>>();
+            } catch (const std::exception& e) {
+                return send(bad_request(e.what()));
             }
+            if (ids.size() > max_page_size)
+                return send(bad_request("Too many ids"));
+            return send(cards_response(req, ids));
         }
-    }
-    {
-        if (req.target().compare("/api/v1/topics") == 0) {
-            if (req.method() == http::verb::post) {
-                json topic_json = json::parse(req.body());
-                TopicSQLiteTable table(m_db.data());
-                int id = table.insert(topic_json);
-                json id_json = {{"id", id}};
-                auto resp = build_json_response(req, id_json);
-                return send(std::move(resp));
-            } else if (req.method() == http::verb::get) {
-                TopicSQLiteTable table(m_db.data());
-                json topics_json = {{"topics", table.get()}};
-                auto resp = build_json_response(req, topics_json);
-                return send(std::move(resp));
-            } else {
-                return send(bad_request("Invalid HTTP-method"));
+        case Route::card_create: {
+            Card card;
+            try {
+                parse_json(req.body(), card);
+            } catch (const std::exception& e) {
+                return send(build_json_response(
+                    req, json{{"success", false}, {"error_msg", e.what()}}));
+            }
+            return write(req, send, [card](SQLiteDatabase& db, json& result) {
+                CardSQLiteTable table(db);
+                result["id"] = table.insert(card);
+            });
+        }
+        ////
+        // Topic API
+        ////
+        case Route::topic_update: {
+            Topic topic;
+            try {
+                parse_json(req.body(), topic);
+            } catch (const std::exception& e) {
+                return send(build_json_response(
+                    req, json{{"success", false}, {"error_msg", e.what()}}));
+            }
+            const int id = match.params[0];
+            return write(req, send, [id, topic](SQLiteDatabase& db, json&) {
+                TopicSQLiteTable table(db);
+                table.update(id, topic);
+            });
+        }
+        case Route::topic_delete: {
+            const int id = match.params[0];
+            return write(req, send, [id](SQLiteDatabase& db, json&) {
+                TopicSQLiteTable table(db);
+                table.remove(id);
+            });
+        }
+        case Route::topic_create: {
+            Topic topic;
+            try {
+                parse_json(req.body(), topic);
+            } catch (const std::exception& e) {
+                return send(build_json_response(
+                    req, json{{"success", false}, {"error_msg", e.what()}}));
             }
-        } 
+            return write(req, send, [topic](SQLiteDatabase& db, json& result) {
+                TopicSQLiteTable table(db);
+                result["id"] = table.insert(topic);
+            });
+        }
+        case Route::topics_get: {
+            auto etag = api_etag('t', TopicSQLiteTable::version());
+            if (etag_matches(req[http::field::if_none_match], etag))
+                return send(not_modified(etag));
+            auto db = m_pool.reader();
+            TopicSQLiteTable table(*db);
+            std::string body = R"({"topics":)";
+            table.write_json(body);
+            body += '}';
+            auto resp = build_json_response(req, std::move(body));
+            resp.set(http::field::etag, etag);
+            resp.set(http::field::cache_control, "no-cache");
+            return send(std::move(resp));
+        }
+        ////
+        // Export
+        ////
+        case Route::export_all: {
+            // The dump is sent over many handler invocations, so it gets
+            // its own connection instead of holding a pooled reader.
+            http::response<ExportBody> resp{
+                std::piecewise_construct,
+                    std::make_tuple(std::unique_ptr<SQLiteExport>(
+                        new SQLiteExport(m_pool.open_reader()))),
+                    std::make_tuple(http::status::ok, req.version())};
+            resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            resp.set(http::field::content_type, "application/x-ndjson");
+            resp.keep_alive(req.keep_alive());
+            resp.prepare_payload();
+            return send(std::move(resp));
+        }
+        ////
+        // Monitoring
+        ////
+        case Route::metrics: {
+            http::response<http::string_body> resp{http::status::ok, req.version()};
+            resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            resp.set(http::field::content_type, "text/plain; version=0.0.4");
+            resp.keep_alive(req.keep_alive());
+            Metrics::instance().scrape(resp.body());
+            resp.body() +=
+                "# HELP nerd_sqlite_pool_waits_total Times a request waited for a connection.\n"
+                "# TYPE nerd_sqlite_pool_waits_total counter\n"
+                "nerd_sqlite_pool_waits_total " + std::to_string(m_pool.waits()) + "\n"
+                "# HELP nerd_sqlite_pool_wait_seconds_total Time requests waited for a connection.\n"
+                "# TYPE nerd_sqlite_pool_wait_seconds_total counter\n"
+                "nerd_sqlite_pool_wait_seconds_total "
+                + std::to_string(m_pool.wait_time_us() / 1e6) + "\n"
+                "# HELP nerd_sqlite_statement_cache_hits_total Prepared statements reused.\n"
+                "# TYPE nerd_sqlite_statement_cache_hits_total counter\n"
+                "nerd_sqlite_statement_cache_hits_total "
+                + std::to_string(m_pool.statement_cache_hits()) + "\n"
+                "# HELP nerd_sqlite_statement_cache_misses_total Statements prepared"
+                " because none was cached.\n"
+                "# TYPE nerd_sqlite_statement_cache_misses_total counter\n"
+                "nerd_sqlite_statement_cache_misses_total "
+                + std::to_string(m_pool.statement_cache_misses()) + "\n";
+            resp.prepare_payload();
+            return send(std::move(resp));
+        }
+        case Route::static_file:
+        case Route::other:
+            break;
+        }
+    } else if (match.path_found) {
+        return send(bad_request("Invalid HTTP-method"));
     }
 
     ////
     // Handle static files.
     ////
+    route = Route::static_file;
+
     // Make sure we can handle the method
     if (req.method() != http::verb::get &&
         req.method() != http::verb::head)
@@ -370,6 +929,55 @@ void HttpServer::handle_request(
         req.target().find("..") != beast::string_view::npos)
         return send(bad_request("Illegal request-target"));
 
+    // Serve the file from memory if possible.
+    auto cached = m_static_files.find(req.target());
+    if (cached) {
+        // Send the smallest encoding the client accepts. Each encoding
+        // has its own entity tag.
+        const auto* encoded = cached->best_encoding(req[http::field::accept_encoding]);
+        const std::string& body = encoded ? encoded->body : cached->body;
+        const std::string& etag = encoded ? encoded->etag : cached->etag;
+        const bool vary = !cached->encoded.empty();
+
+        if (etag_matches(req[http::field::if_none_match], etag)) {
+            auto resp = not_modified(etag);
+            if (vary)
+                resp.set(http::field::vary, "Accept-Encoding");
+            return send(std::move(resp));
+        }
+
+        auto set_headers = [&](http::fields& fields) {
+            fields.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            fields.set(http::field::content_type, cached->content_type);
+            if (encoded)
+                fields.set(http::field::content_encoding, encoded->coding);
+            if (vary)
+                fields.set(http::field::vary, "Accept-Encoding");
+            fields.set(http::field::etag, etag);
+            fields.set(http::field::cache_control, "no-cache");
+        };
+
+        if (req.method() == http::verb::head) {
+            http::response<http::empty_body> resp{http::status::ok, req.version()};
+            set_headers(resp);
+            resp.content_length(body.size());
+            resp.keep_alive(req.keep_alive());
+            return send(std::move(resp));
+        }
+
+        // Points into the cached file and keeps it alive.
+        std::shared_ptr<const std::string> shared_body(cached, &body);
+        http::response<CachedFileBody> resp{
+            std::piecewise_construct,
+                std::make_tuple(std::move(shared_body)),
+                std::make_tuple(http::status::ok, req.version())};
+        set_headers(resp);
+        resp.content_length(body.size());
+        resp.keep_alive(req.keep_alive());
+        return send(std::move(resp));
+    }
+
+    // Not cached: too large or created after the last reload.
     // Build the path to the requested file
     std::string path = path_cat(m_doc_root, req.target());
     if (req.target().back() == '/')
@@ -377,8 +985,8 @@ void HttpServer::handle_request(
 
     // Attempt to open the file
     beast::error_code ec;
-    http::file_body::value_type body;
-    body.open(path.c_str(), beast::file_mode::scan, ec);
+    FileRangeBody::value_type body;
+    body.file.open(path.c_str(), beast::file_mode::scan, ec);
 
     // Handle the case where the file doesn't exist
     if (ec == beast::errc::no_such_file_or_directory)
@@ -388,27 +996,65 @@ void HttpServer::handle_request(
     if (ec)
         return send(server_error(ec.message()));
 
-    // Cache the size since we need it after the move
-    auto const size = body.size();
+    auto const size = body.file.size(ec);
+    if (ec)
+        return send(server_error(ec.message()));
+
+    const auto etag = file_etag(body.file.native_handle());
+    if (!etag.empty() && etag_matches(req[http::field::if_none_match], etag))
+        return send(not_modified(etag));
 
     // Respond to HEAD request
     if (req.method() == http::verb::head) {
         http::response<http::empty_body> resp{http::status::ok, req.version()};
         resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
         resp.set(http::field::content_type, mime_type(path));
+        resp.set(http::field::accept_ranges, "bytes");
+        if (!etag.empty())
+            resp.set(http::field::etag, etag);
+        resp.set(http::field::cache_control, "no-cache");
         resp.content_length(size);
         resp.keep_alive(req.keep_alive());
         return send(std::move(resp));
     }
 
+    // A single range of bytes is sent as 206 Partial Content. With
+    // If-Range, only if the entity tag is still the same (strong
+    // comparison); otherwise the whole file is sent.
+    body.size = size;
+    auto range = ByteRange::none;
+    const auto if_range = req[http::field::if_range];
+    if (if_range.empty() || (!etag.empty() && if_range == etag))
+        range = parse_range(req[http::field::range], size, body.offset, body.size);
+    if (range == ByteRange::unsatisfiable) {
+        http::response<http::empty_body> resp{http::status::range_not_satisfiable, req.version()};
+        resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        resp.set(http::field::content_range, "bytes */" + std::to_string(size));
+        resp.content_length(0);
+        resp.keep_alive(req.keep_alive());
+        return send(std::move(resp));
+    }
+
     // Respond to GET request
-    http::response<http::file_body> resp{
+    const auto status = range == ByteRange::satisfiable
+        ? http::status::partial_content : http::status::ok;
+    http::response<FileRangeBody> resp{
         std::piecewise_construct,
             std::make_tuple(std::move(body)),
-            std::make_tuple(http::status::ok, req.version())};
+            std::make_tuple(status, req.version())};
     resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     resp.set(http::field::content_type, mime_type(path));
-    resp.content_length(size);
+    resp.set(http::field::accept_ranges, "bytes");
+    if (!etag.empty())
+        resp.set(http::field::etag, etag);
+    resp.set(http::field::cache_control, "no-cache");
+    if (range == ByteRange::satisfiable) {
+        resp.set(http::field::content_range,
+                 "bytes " + std::to_string(resp.body().offset) + "-"
+                 + std::to_string(resp.body().offset + resp.body().size - 1)
+                 + "/" + std::to_string(size));
+    }
+    resp.content_length(resp.body().size);
     resp.keep_alive(req.keep_alive());
     return send(std::move(resp));
 }
@@ -1,34 +1,97 @@
 #ifndef NERD_HTTP_SERVER_H
 #define NERD_HTTP_SERVER_H
 
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 
+#include "metrics.h"
 #include "names.h"
+#include "router.h"
+#include "sqlite_connection_pool.h"
 #include "sqlite_database.h"
+#include "sqlite_write_queue.h"
+#include "static_file_cache.h"
 
 
 namespace nerd {
 
 class HttpServer {
 public:
-    HttpServer(SQLiteDatabase db,
+    HttpServer(SQLiteConnectionPool& pool,
                net::ip::address addr, unsigned short port,
-               std::string doc_root)
-    : m_db{std::move(db)}
-    , m_ioctx{1}
+               std::string doc_root,
+               int threads = 1)
+    : m_pool(pool)
+    , m_ioctx{threads}
+    , m_writes{pool, max_write_batch, max_write_delay}
     , m_acceptor{m_ioctx, {addr, port}}
     , m_doc_root{std::move(doc_root)}
+    , m_static_files{m_doc_root, max_cached_file_size}
+    , m_threads{threads}
     {
+        add_routes();
+        m_static_files.watch(m_ioctx);
     }
 
+    // Accept and serve connections on m_threads worker threads.
+    // Blocks until the server is stopped.
     void run();
 
+    // Make run() return as soon as possible. Thread-safe.
+    void stop();
+
+    // The port the server listens on (useful when constructed with port 0).
+    unsigned short port() const;
+
 private:
 
+    // Ids of the API routes registered in m_router.
+    enum class Route {
+        card_get,
+        card_update,
+        card_delete,
+        cards_get,
+        card_create,
+        cards_import,
+        cards_search,
+        cards_lookup,
+        topic_update,
+        topic_delete,
+        topic_create,
+        topics_get,
+        export_all,
+        metrics,
+
+        // Metrics labels of requests not handled by the API.
+        static_file,
+        other
+    };
+
+    // Number of cards per page of GET /api/v1/cards,
+    // also the maximum number of ids of a multi-get.
+    static constexpr int default_page_size = 100;
+    static constexpr int max_page_size = 1000;
+
+    // Larger files of the doc root are read from disk on every request.
+    static constexpr std::size_t max_cached_file_size = 1 << 20;
+
+    // Limit of request bodies, large enough for bulk imports.
+    static constexpr std::size_t max_request_body_size = 64 << 20;
+
+    // Mutations are committed in batches of at most max_write_batch.
+    // A batch waits up to max_write_delay for more mutations; with no
+    // delay it holds those that arrived during the previous commit.
+    static constexpr std::size_t max_write_batch = 256;
+    static constexpr std::chrono::microseconds max_write_delay{0};
+
     //////////////////////////////
     // Static functions.
     //////////////////////////////
@@ -38,8 +101,25 @@ private:
         const http::request<Body, http::basic_fields<Allocator>>& req,
         const json& response_json);
 
-    // Return a reasonable mime type based on the extension of a file.
-    static beast::string_view mime_type(beast::string_view path);
+    // Same for an already serialized JSON body, which is moved
+    // into the response without copying.
+    template<class Body, class Allocator>
+    http::response<http::string_body> build_json_response(
+        const http::request<Body, http::basic_fields<Allocator>>& req,
+        std::string&& body);
+
+    // Same for responses built after the request is gone.
+    static http::response<http::string_body> build_json_response(
+        unsigned version, bool keep_alive, std::string&& body);
+
+    // Return true if the value of an If-None-Match header
+    // matches the given entity tag.
+    static bool etag_matches(beast::string_view if_none_match,
+                             beast::string_view etag);
+
+    // Entity tag for API resources depending on a table
+    // (abbreviated by a single character) in the given version.
+    static std::string api_etag(char table, unsigned long version);
 
     // Report a failure
     static void fail(beast::error_code ec, char const* what);
@@ -55,36 +135,27 @@ private:
     // Helper classes
     //////////////////////////////
 
-    // This is the C++11 equivalent of a generic lambda.
-    // The function object is used to send an HTTP message.
-    template<class Stream>
-    struct send_lambda {
-        Stream& stream_;
-        bool& close_;
-        beast::error_code& ec_;
-
-        explicit send_lambda(
-            Stream& stream,
-            bool& close,
-            beast::error_code& ec)
-            : stream_(stream)
-              , close_(close)
-              , ec_(ec)
-        {
-        }
+    // Handles a single HTTP server connection asynchronously.
+    // Defined in http_server.cpp.
+    class Session;
+
+    // Forwards a response to `send_` and records it in the metrics
+    // under the route that handled the request. Copyable, so it can
+    // complete requests from the write queue.
+    template<class Send>
+    struct metered_send {
+        Send send_;
+        Route route_;
+        std::chrono::steady_clock::time_point start_;
 
         template<bool isRequest, class Body, class Fields>
         void
         operator()(http::message<isRequest, Body, Fields>&& msg) const
         {
-            // Determine if we should close the connection after
-            close_ = msg.need_eof();
-
-            // We need the serializer here because the serializer requires
-            // a non-const file_body, and the message oriented version of
-            // http::write only works with const messages.
-            http::serializer<isRequest, Body, Fields> sr{msg};
-            http::write(stream_, sr, ec_);
+            Metrics::instance().record_request(
+                static_cast<int>(route_), msg.result_int(),
+                std::chrono::steady_clock::now() - start_);
+            send_(std::move(msg));
         }
     };
 
@@ -93,8 +164,27 @@ private:
     // Non-static functions
     //////////////////////////////
 
-    // Handles an HTTP server connection
-    void do_session(tcp::socket& socket);
+    // Register the API routes in m_router.
+    void add_routes();
+
+    // Response with the details of the cards with the given ids.
+    template<class Body, class Allocator>
+    http::response<http::string_body> cards_response(
+        const http::request<Body, http::basic_fields<Allocator>>& req,
+        const std::vector<int>& ids);
+
+    // Start accepting the next connection.
+    void do_accept();
+
+    void on_accept(beast::error_code ec, tcp::socket socket);
+
+    // Run `mutation` in the write queue and send the response once its
+    // batch is committed: {"success":true}, or the JSON the mutation
+    // stored in its second argument, or {"success":false,...} on error.
+    template<class Body, class Allocator, class Send>
+    void write(const http::request<Body, http::basic_fields<Allocator>>& req,
+               const Send& send,
+               std::function<void(SQLiteDatabase&, json&)> mutation);
 
     // This function produces an HTTP response for the given
     // request. The type of the response object depends on the
@@ -104,13 +194,17 @@ private:
     void handle_request(
         //http::request<Body, http::basic_fields<Allocator>>&& req, // because of gdb bug
         http::request<Body, http::basic_fields<Allocator>> req,
-        Send&& send);
+        Send&& send_response);
 
 private:
-    SQLiteDatabase m_db;
+    SQLiteConnectionPool& m_pool;
     net::io_context m_ioctx;
+    SQLiteWriteQueue m_writes;  // after m_ioctx, completions post to it
     tcp::acceptor m_acceptor;
     std::string m_doc_root;
+    StaticFileCache m_static_files;
+    int m_threads;
+    Router m_router;
 };
 
 }   // nerd
@@ -0,0 +1,225 @@
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "json_reader.h"
+
+namespace nerd {
+
+JsonReader::JsonReader(beast::string_view text)
+    : m_text{text}
+    , m_pos{0}
+{
+}
+
+void JsonReader::begin_object()
+{
+    expect('{');
+    m_first.push_back(true);
+}
+
+bool JsonReader::next_key(std::string& key)
+{
+    if (!next('}'))
+        return false;
+    if (peek() != '"')
+        fail("expected key");
+    read_string(key);
+    expect(':');
+    return true;
+}
+
+void JsonReader::begin_array()
+{
+    expect('[');
+    m_first.push_back(true);
+}
+
+bool JsonReader::next_element()
+{
+    return next(']');
+}
+
+char JsonReader::peek()
+{
+    skip_whitespace();
+    return m_pos < m_text.size() ? m_text[m_pos] : '\0';
+}
+
+void JsonReader::read_string(std::string& out)
+{
+    expect('"');
+    out.clear();
+    for (;;) {
+        // Copy the run of plain characters at once.
+        auto start = m_pos;
+        while (m_pos < m_text.size()) {
+            const unsigned char c = m_text[m_pos];
+            if (c == '"' || c == '\\' || c < 0x20)
+                break;
+            ++m_pos;
+        }
+        out.append(m_text.data() + start, m_pos - start);
+
+        if (m_pos == m_text.size())
+            fail("unterminated string");
+        const char c = m_text[m_pos++];
+        if (c == '"')
+            return;
+        if (c != '\\')
+            fail("control character in string");
+        if (m_pos == m_text.size())
+            fail("unterminated string");
+
+        switch (m_text[m_pos++]) {
+        case '"':  out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/':  out += '/'; break;
+        case 'b':  out += '\b'; break;
+        case 'f':  out += '\f'; break;
+        case 'n':  out += '\n'; break;
+        case 'r':  out += '\r'; break;
+        case 't':  out += '\t'; break;
+        case 'u': {
+            unsigned cp = read_hex4();
+            if (cp >= 0xd800 && cp < 0xdc00) {
+                // High surrogate, has to be followed by a low one.
+                if (m_text.substr(m_pos, 2) != "\\u")
+                    fail("unpaired surrogate");
+                m_pos += 2;
+                unsigned low = read_hex4();
+                if (low < 0xdc00 || low >= 0xe000)
+                    fail("unpaired surrogate");
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            } else if (cp >= 0xdc00 && cp < 0xe000) {
+                fail("unpaired surrogate");
+            }
+
+            // UTF-8
+            if (cp < 0x80) {
+                out += static_cast<char>(cp);
+            } else if (cp < 0x800) {
+                out += static_cast<char>(0xc0 | (cp >> 6));
+                out += static_cast<char>(0x80 | (cp & 0x3f));
+            } else if (cp < 0x10000) {
+                out += static_cast<char>(0xe0 | (cp >> 12));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+                out += static_cast<char>(0x80 | (cp & 0x3f));
+            } else {
+                out += static_cast<char>(0xf0 | (cp >> 18));
+                out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+                out += static_cast<char>(0x80 | (cp & 0x3f));
+            }
+            break;
+        }
+        default:
+            --m_pos;
+            fail("invalid escape");
+        }
+    }
+}
+
+int JsonReader::read_int()
+{
+    skip_whitespace();
+    const bool negative = m_pos < m_text.size() && m_text[m_pos] == '-';
+    if (negative)
+        ++m_pos;
+    const auto start = m_pos;
+    long long value = 0;
+    while (m_pos < m_text.size() && m_text[m_pos] >= '0' && m_text[m_pos] <= '9') {
+        value = value * 10 + (m_text[m_pos++] - '0');
+        if (value > static_cast<long long>(std::numeric_limits<int>::max()) + 1)
+            fail("integer out of range");
+    }
+    if (m_pos == start)
+        fail("expected integer");
+    if (m_text[start] == '0' && m_pos - start > 1)
+        fail("leading zero");
+    if (m_pos < m_text.size()
+        && (m_text[m_pos] == '.' || m_text[m_pos] == 'e' || m_text[m_pos] == 'E'))
+        fail("expected integer");
+    if (negative)
+        value = -value;
+    if (value > std::numeric_limits<int>::max())
+        fail("integer out of range");
+    return static_cast<int>(value);
+}
+
+bool JsonReader::read_null()
+{
+    if (peek() != 'n')
+        return false;
+    if (m_text.substr(m_pos, 4) != "null")
+        fail("invalid literal");
+    m_pos += 4;
+    return true;
+}
+
+void JsonReader::end()
+{
+    if (peek() != '\0')
+        fail("unexpected data after the end");
+}
+
+void JsonReader::fail(const std::string& what) const
+{
+    throw std::invalid_argument(
+        "invalid JSON at " + std::to_string(m_pos) + ": " + what);
+}
+
+void JsonReader::skip_whitespace()
+{
+    while (m_pos < m_text.size()) {
+        const char c = m_text[m_pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        ++m_pos;
+    }
+}
+
+void JsonReader::expect(char c)
+{
+    if (peek() != c)
+        fail(std::string("expected '") + c + "'");
+    ++m_pos;
+}
+
+bool JsonReader::next(char close)
+{
+    if (m_first.empty())
+        fail("not in an object or array");
+    if (peek() == close) {
+        ++m_pos;
+        m_first.pop_back();
+        return false;
+    }
+    if (m_first.back())
+        m_first.back() = false;
+    else
+        expect(',');
+    return true;
+}
+
+unsigned JsonReader::read_hex4()
+{
+    if (m_text.size() - m_pos < 4)
+        fail("invalid \\u escape");
+    unsigned value = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = m_text[m_pos++];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            fail("invalid \\u escape");
+    }
+    return value;
+}
+
+}   // nerd
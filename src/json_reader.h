@@ -0,0 +1,81 @@
+#ifndef NERD_JSON_READER_H
+#define NERD_JSON_READER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "names.h"
+
+namespace nerd {
+
+// Pull parser for JSON request bodies. The caller asks for the values it
+// expects, in order, and the reader checks the syntax on the way; nothing
+// is built that the caller doesn't keep. Errors throw std::invalid_argument
+// with the offset into the text.
+//
+//   JsonReader in(body);
+//   in.begin_object();
+//   std::string key;
+//   while (in.next_key(key)) {
+//       if (key == "name")
+//           in.read_string(name);
+//       else
+//           in.fail("unknown field");
+//   }
+//   in.end();
+class JsonReader {
+public:
+    explicit JsonReader(beast::string_view text);
+
+    // Consume '{'.
+    void begin_object();
+
+    // Read the key of the next member of the current object, including
+    // the ':' after it. Returns false and consumes '}' after the last one.
+    bool next_key(std::string& key);
+
+    // Consume '['.
+    void begin_array();
+
+    // Move to the next element of the current array. Returns false and
+    // consumes ']' after the last one.
+    bool next_element();
+
+    // The first character of the next value, or '\0' at the end.
+    char peek();
+
+    // Consume the next value, which must have the given type.
+    void read_string(std::string& out);
+    int read_int();
+
+    // Consume null if it is next. Returns true if it was.
+    bool read_null();
+
+    // Check that only whitespace is left.
+    void end();
+
+    // Throw std::invalid_argument with the current position.
+    [[noreturn]] void fail(const std::string& what) const;
+
+private:
+    void skip_whitespace();
+
+    // Consume `c` after optional whitespace, fail if it isn't next.
+    void expect(char c);
+
+    // Consume a comma unless the current element is the first of its
+    // container. Returns false and consumes `close` if it's next.
+    bool next(char close);
+
+    // Read the four hex digits of a \u escape.
+    unsigned read_hex4();
+
+    beast::string_view m_text;
+    std::size_t m_pos;
+    std::vector<bool> m_first;  // per open container: no element read yet
+};
+
+}   // nerd
+
+#endif  // NERD_JSON_READER_H
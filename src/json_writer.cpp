@@ -0,0 +1,132 @@
+#include <cstddef>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NERD_JSON_WRITER_X86
+#endif
+
+#include "json_writer.h"
+
+namespace nerd {
+
+namespace {
+
+// Each returns the length of the prefix of [p, p + n) that can be copied
+// without escaping: no '"', '\\' or control character. Bytes >= 0x80 are
+// part of UTF-8 sequences and are copied as they are.
+typedef std::size_t (*PlainPrefixFn)(const char* p, std::size_t n);
+
+inline bool needs_escape(char c)
+{
+    return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+std::size_t plain_prefix_scalar(const char* p, std::size_t n)
+{
+    std::size_t i = 0;
+    while (i < n && !needs_escape(p[i]))
+        ++i;
+    return i;
+}
+
+#ifdef NERD_JSON_WRITER_X86
+
+// 16 bytes at a time. A byte needs escaping if it equals '"' or '\\', or
+// if min(byte, 0x1f) == byte (unsigned compare).
+__attribute__((target("sse2")))
+std::size_t plain_prefix_sse2(const char* p, std::size_t n)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        const int mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + plain_prefix_scalar(p + i, n - i);
+}
+
+// Same with 32 bytes at a time.
+__attribute__((target("avx2")))
+std::size_t plain_prefix_avx2(const char* p, std::size_t n)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        const __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+        const unsigned mask = _mm256_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + plain_prefix_sse2(p + i, n - i);
+}
+
+#endif  // NERD_JSON_WRITER_X86
+
+// The fastest variant the CPU we run on supports.
+PlainPrefixFn select_plain_prefix()
+{
+#ifdef NERD_JSON_WRITER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return plain_prefix_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return plain_prefix_sse2;
+#endif
+    return plain_prefix_scalar;
+}
+
+}   // namespace
+
+void append_json_string(std::string& out, beast::string_view s)
+{
+    static const char hex[] = "0123456789abcdef";
+    static const PlainPrefixFn plain_prefix = select_plain_prefix();
+
+    out.reserve(out.size() + s.size() + 2);
+    out += '"';
+    const char* p = s.data();
+    std::size_t n = s.size();
+    while (n > 0) {
+        // Copy the run of characters that stay as they are at once.
+        const std::size_t plain = plain_prefix(p, n);
+        out.append(p, plain);
+        p += plain;
+        n -= plain;
+        if (n == 0)
+            break;
+
+        const char c = *p++;
+        --n;
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            out += "\\u00";
+            out += hex[(c >> 4) & 0xf];
+            out += hex[c & 0xf];
+        }
+    }
+    out += '"';
+}
+
+}   // nerd
@@ -0,0 +1,19 @@
+#ifndef NERD_JSON_WRITER_H
+#define NERD_JSON_WRITER_H
+
+#include <string>
+
+#include <boost/beast/core.hpp>
+
+#include "names.h"
+
+namespace nerd {
+
+// Append `s` as a quoted and escaped JSON string to `out`.
+// The input is expected to be UTF-8 and is copied unchanged
+// apart from the characters JSON requires to be escaped.
+void append_json_string(std::string& out, beast::string_view s);
+
+}   // nerd
+
+#endif  // NERD_JSON_WRITER_H
@@ -0,0 +1,259 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>       // snprintf
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+
+namespace {
+
+using Counter = std::atomic<std::uint64_t>;
+
+// Upper bounds of the latency histogram buckets, in seconds.
+const double bucket_bounds[nerd::Metrics::n_buckets - 1] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+    0.025, 0.05, 0.1, 0.25, 0.5, 1.0
+};
+
+const unsigned min_status = 100;
+const unsigned max_status = 599;
+
+// Only the owning thread writes a counter, so a relaxed
+// load and store is enough and cheaper than fetch_add.
+template<class T>
+void add(std::atomic<T>& counter, T n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+}
+
+std::uint64_t nanoseconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+std::string seconds(std::uint64_t ns)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof buf, "%.9f", ns / 1e9);
+    return buf;
+}
+
+}
+
+namespace nerd {
+
+constexpr int Metrics::max_routes;
+constexpr int Metrics::n_buckets;
+
+struct Metrics::Shard {
+    Counter requests[max_routes][max_status - min_status + 1];
+    Counter latency_buckets[max_routes][n_buckets];
+    Counter latency_sum_ns[max_routes];
+    Counter bytes_in;
+    Counter bytes_out;
+    std::atomic<std::int64_t> active_connections;
+    Counter sqlite_steps;
+    Counter sqlite_step_ns;
+    Counter arena_requests;
+    Counter arena_allocations;
+    Counter arena_bytes;
+    Counter arena_heap_allocations;
+
+    Shard()
+    {
+        // Atomics aren't zero-initialized by default.
+        for (auto& route : requests)
+            for (auto& c : route)
+                c = 0;
+        for (auto& route : latency_buckets)
+            for (auto& c : route)
+                c = 0;
+        for (auto& c : latency_sum_ns)
+            c = 0;
+        bytes_in = 0;
+        bytes_out = 0;
+        active_connections = 0;
+        sqlite_steps = 0;
+        sqlite_step_ns = 0;
+        arena_requests = 0;
+        arena_allocations = 0;
+        arena_bytes = 0;
+        arena_heap_allocations = 0;
+    }
+};
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::set_routes(std::vector<std::string> names)
+{
+    if (names.size() > max_routes)
+        names.resize(max_routes);
+    m_routes = std::move(names);
+}
+
+Metrics::Shard& Metrics::shard()
+{
+    // Shards are never freed; there is one per thread that ever recorded.
+    thread_local Shard* shard = nullptr;
+    if (!shard) {
+        std::unique_ptr<Shard> s(new Shard);
+        shard = s.get();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shards.push_back(std::move(s));
+    }
+    return *shard;
+}
+
+void Metrics::record_request(int route, unsigned status,
+                             std::chrono::steady_clock::duration latency)
+{
+    if (route < 0 || route >= max_routes
+        || status < min_status || status > max_status)
+        return;
+
+    Shard& s = shard();
+    add<std::uint64_t>(s.requests[route][status - min_status], 1);
+
+    const auto ns = nanoseconds(latency);
+    int bucket = 0;
+    while (bucket < n_buckets - 1 && ns > bucket_bounds[bucket] * 1e9)
+        ++bucket;
+    add<std::uint64_t>(s.latency_buckets[route][bucket], 1);
+    add(s.latency_sum_ns[route], ns);
+}
+
+void Metrics::record_bytes(std::size_t in, std::size_t out)
+{
+    Shard& s = shard();
+    add<std::uint64_t>(s.bytes_in, in);
+    add<std::uint64_t>(s.bytes_out, out);
+}
+
+void Metrics::connection_opened()
+{
+    add<std::int64_t>(shard().active_connections, 1);
+}
+
+void Metrics::connection_closed()
+{
+    add<std::int64_t>(shard().active_connections, -1);
+}
+
+void Metrics::record_sqlite_step(std::chrono::steady_clock::duration time)
+{
+    Shard& s = shard();
+    add<std::uint64_t>(s.sqlite_steps, 1);
+    add(s.sqlite_step_ns, nanoseconds(time));
+}
+
+void Metrics::record_request_allocations(std::size_t allocations, std::size_t bytes,
+                                         std::size_t heap_allocations)
+{
+    Shard& s = shard();
+    add<std::uint64_t>(s.arena_requests, 1);
+    add<std::uint64_t>(s.arena_allocations, allocations);
+    add<std::uint64_t>(s.arena_bytes, bytes);
+    add<std::uint64_t>(s.arena_heap_allocations, heap_allocations);
+}
+
+void Metrics::scrape(std::string& out) const
+{
+    // Sum up all shards.
+    std::unique_ptr<Shard> total(new Shard);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& s : m_shards) {
+            for (int r = 0; r < max_routes; ++r) {
+                for (unsigned i = 0; i <= max_status - min_status; ++i)
+                    add<std::uint64_t>(total->requests[r][i], s->requests[r][i]);
+                for (int b = 0; b < n_buckets; ++b)
+                    add<std::uint64_t>(total->latency_buckets[r][b],
+                                       s->latency_buckets[r][b]);
+                add<std::uint64_t>(total->latency_sum_ns[r], s->latency_sum_ns[r]);
+            }
+            add<std::uint64_t>(total->bytes_in, s->bytes_in);
+            add<std::uint64_t>(total->bytes_out, s->bytes_out);
+            add<std::int64_t>(total->active_connections, s->active_connections);
+            add<std::uint64_t>(total->sqlite_steps, s->sqlite_steps);
+            add<std::uint64_t>(total->sqlite_step_ns, s->sqlite_step_ns);
+            add<std::uint64_t>(total->arena_requests, s->arena_requests);
+            add<std::uint64_t>(total->arena_allocations, s->arena_allocations);
+            add<std::uint64_t>(total->arena_bytes, s->arena_bytes);
+            add<std::uint64_t>(total->arena_heap_allocations, s->arena_heap_allocations);
+        }
+    }
+
+    out += "# HELP nerd_http_requests_total HTTP requests by route and status code.\n"
+           "# TYPE nerd_http_requests_total counter\n";
+    for (std::size_t r = 0; r < m_routes.size(); ++r) {
+        for (unsigned i = 0; i <= max_status - min_status; ++i) {
+            if (total->requests[r][i] == 0)
+                continue;
+            out += "nerd_http_requests_total{route=\"" + m_routes[r]
+                + "\",code=\"" + std::to_string(min_status + i) + "\"} "
+                + std::to_string(total->requests[r][i]) + "\n";
+        }
+    }
+
+    out += "# HELP nerd_http_request_duration_seconds Time from reading a request"
+           " to handing its response to the writer.\n"
+           "# TYPE nerd_http_request_duration_seconds histogram\n";
+    for (std::size_t r = 0; r < m_routes.size(); ++r) {
+        const std::string label = "{route=\"" + m_routes[r] + "\"";
+        std::uint64_t count = 0;
+        for (int b = 0; b < n_buckets; ++b) {
+            count += total->latency_buckets[r][b];
+            char le[32];
+            if (b < n_buckets - 1)
+                std::snprintf(le, sizeof le, "%g", bucket_bounds[b]);
+            else
+                std::snprintf(le, sizeof le, "+Inf");
+            out += "nerd_http_request_duration_seconds_bucket" + label
+                + ",le=\"" + le + "\"} " + std::to_string(count) + "\n";
+        }
+        out += "nerd_http_request_duration_seconds_sum" + label + "} "
+            + seconds(total->latency_sum_ns[r]) + "\n";
+        out += "nerd_http_request_duration_seconds_count" + label + "} "
+            + std::to_string(count) + "\n";
+    }
+
+    out += "# HELP nerd_http_request_bytes_total Bytes of requests read.\n"
+           "# TYPE nerd_http_request_bytes_total counter\n"
+           "nerd_http_request_bytes_total " + std::to_string(total->bytes_in) + "\n";
+    out += "# HELP nerd_http_response_bytes_total Bytes of responses written.\n"
+           "# TYPE nerd_http_response_bytes_total counter\n"
+           "nerd_http_response_bytes_total " + std::to_string(total->bytes_out) + "\n";
+    out += "# HELP nerd_http_active_connections Open client connections.\n"
+           "# TYPE nerd_http_active_connections gauge\n"
+           "nerd_http_active_connections "
+           + std::to_string(total->active_connections) + "\n";
+    out += "# HELP nerd_sqlite_step_seconds Time spent in sqlite3_step.\n"
+           "# TYPE nerd_sqlite_step_seconds summary\n"
+           "nerd_sqlite_step_seconds_sum " + seconds(total->sqlite_step_ns) + "\n"
+           "nerd_sqlite_step_seconds_count " + std::to_string(total->sqlite_steps) + "\n";
+    out += "# HELP nerd_request_allocations Allocations per request read, from the"
+           " connection's arena.\n"
+           "# TYPE nerd_request_allocations summary\n"
+           "nerd_request_allocations_sum " + std::to_string(total->arena_allocations) + "\n"
+           "nerd_request_allocations_count " + std::to_string(total->arena_requests) + "\n";
+    out += "# HELP nerd_request_allocated_bytes Bytes allocated per request read.\n"
+           "# TYPE nerd_request_allocated_bytes summary\n"
+           "nerd_request_allocated_bytes_sum " + std::to_string(total->arena_bytes) + "\n"
+           "nerd_request_allocated_bytes_count " + std::to_string(total->arena_requests) + "\n";
+    out += "# HELP nerd_request_heap_allocations_total Allocations for requests that"
+           " didn't fit the connection's arena block.\n"
+           "# TYPE nerd_request_heap_allocations_total counter\n"
+           "nerd_request_heap_allocations_total "
+           + std::to_string(total->arena_heap_allocations) + "\n";
+}
+
+}   // nerd
@@ -0,0 +1,59 @@
+#ifndef NERD_METRICS_H
+#define NERD_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// Process-wide request and database metrics in Prometheus text format.
+// Every thread records into its own shard with relaxed atomic stores, so
+// recording never locks or contends; a scrape sums up all shards.
+class Metrics {
+public:
+    static constexpr int max_routes = 32;
+    static constexpr int n_buckets = 14;   // including +Inf
+
+    static Metrics& instance();
+
+    // Names of the route labels; indices are passed to record_request().
+    // Has to be called before any request is recorded.
+    void set_routes(std::vector<std::string> names);
+
+    void record_request(int route, unsigned status,
+                        std::chrono::steady_clock::duration latency);
+    void record_bytes(std::size_t in, std::size_t out);
+    void connection_opened();
+    void connection_closed();
+    void record_sqlite_step(std::chrono::steady_clock::duration time);
+
+    // Allocations made for reading one request, see RequestArena.
+    void record_request_allocations(std::size_t allocations, std::size_t bytes,
+                                    std::size_t heap_allocations);
+
+    // Append all metrics in Prometheus text exposition format to `out`.
+    void scrape(std::string& out) const;
+
+private:
+    struct Shard;
+
+    Metrics() = default;
+
+    // The shard of the calling thread, created on first use.
+    Shard& shard();
+
+    std::vector<std::string> m_routes;
+
+    mutable std::mutex m_mutex;     // guards m_shards, not the counters
+    std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+}   // nerd
+
+#endif  // NERD_METRICS_H
@@ -9,7 +9,7 @@
 
 //------------------------------------------------------------------------------
 //
-// Example: HTTP server, synchronous
+// Example: HTTP server, asynchronous
 //
 //------------------------------------------------------------------------------
 
@@ -21,6 +21,7 @@
 #include <boost/beast/version.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
+#include <algorithm>    // max
 #include <cstdlib>      // EXIT_FAILURE
 #include <exception>
 #include <iostream>
@@ -32,10 +33,28 @@
 
 #include "http_server.h"
 #include "names.h"
+#include "sqlite_connection_pool.h"
 #include "sqlite_database.h"
+#include "sqlite_pragma_profile.h"
 
 using namespace nerd;
 
+namespace {
+
+void usage()
+{
+    std::cerr <<
+        "Usage: nerd (create_database | [<options>] <address> <port> <doc_root>)\n" <<
+        "Options:\n" <<
+        "    --threads <n>          number of worker threads\n" <<
+        "    --pragmas <file>       read SQLite pragma profile from file\n" <<
+        "    --pragma <key=value>   set a single SQLite pragma\n" <<
+        "Example:\n" <<
+        "    nerd --threads 4 --pragma synchronous=FULL 0.0.0.0 8080 .\n";
+}
+
+}
+
 int main(int argc, char* argv[])
 {
     try {
@@ -44,20 +63,48 @@ int main(int argc, char* argv[])
             SQLiteDatabase db{"nerdbase.db"};
             db.init();
             return 0;
-        } else if (argc == 4) {
-            auto const address = net::ip::make_address(argv[1]);
-            auto const port = static_cast<unsigned short>(std::atoi(argv[2]));
-            auto const doc_root = std::string(argv[3]);
-            SQLiteDatabase db{"nerdbase.db"};
+        }
+
+        // Default to one worker thread per core.
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+        SQLitePragmaProfile profile;
+        int argi = 1;
+        for (; argi + 1 < argc && std::string(argv[argi]).compare(0, 2, "--") == 0;
+             argi += 2) {
+            const std::string option(argv[argi]);
+            if (option == "--threads") {
+                threads = std::atoi(argv[argi + 1]);
+            } else if (option == "--pragmas") {
+                profile = SQLitePragmaProfile::from_file(argv[argi + 1]);
+            } else if (option == "--pragma") {
+                profile.set(argv[argi + 1]);
+            } else {
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (argc - argi == 3 && threads > 0) {
+            auto const address = net::ip::make_address(argv[argi]);
+            auto const port = static_cast<unsigned short>(std::atoi(argv[argi + 1]));
+            auto const doc_root = std::string(argv[argi + 2]);
+            // One read connection per worker thread.
+            SQLiteConnectionPool pool{"nerdbase.db", threads, profile};
+
+            {   // Report the settings actually in effect.
+                auto db = pool.writer();
+                std::cout << "SQLite pragmas:";
+                for (const auto& p : profile.pragmas())
+                    std::cout << " " << p.first << "=" << db->pragma(p.first);
+                std::cout << std::endl;
+            }
 
-            HttpServer server(std::move(db), address, port, std::move(doc_root));
+            HttpServer server(pool, address, port, std::move(doc_root),
+                              threads);
             server.run();
             return 0;
         } else  {
-            std::cerr <<
-                "Usage: nerd (create_database | <address> <port> <doc_root>)\n" <<
-                "Example:\n" <<
-                "    nerd 0.0.0.0 8080 .\n";
+            usage();
             return EXIT_FAILURE;
         }
     } catch (const std::exception& e) {
@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "request_arena.h"
+
+namespace nerd {
+
+constexpr std::size_t RequestArena::default_block_size;
+
+RequestArena::RequestArena(std::size_t block_size)
+    : m_block_size{block_size}
+{
+    add_block();
+}
+
+RequestArena::~RequestArena()
+{
+    while (m_blocks) {
+        Block* next = m_blocks->next;
+        ::operator delete(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* RequestArena::allocate(std::size_t size, std::size_t align)
+{
+    ++m_allocations;
+    m_bytes += size;
+    if (is_large(size)) {
+        ++m_heap_allocations;
+        return ::operator new(size);
+    }
+
+    // Round up to `align`, or continue in a new block.
+    auto offset = reinterpret_cast<std::uintptr_t>(m_pos) % align;
+    char* p = offset ? m_pos + (align - offset) : m_pos;
+    if (p + size > m_end) {
+        add_block();
+        ++m_heap_allocations;
+        p = m_pos;
+    }
+    m_pos = p + size;
+    return p;
+}
+
+void RequestArena::deallocate(void* p, std::size_t size)
+{
+    if (is_large(size))
+        ::operator delete(p);
+}
+
+void RequestArena::reset()
+{
+    while (m_blocks->next) {
+        Block* next = m_blocks->next;
+        ::operator delete(m_blocks);
+        m_blocks = next;
+    }
+    m_pos = reinterpret_cast<char*>(m_blocks) + sizeof(std::max_align_t);
+    m_end = reinterpret_cast<char*>(m_blocks) + m_block_size;
+    m_allocations = 0;
+    m_bytes = 0;
+    m_heap_allocations = 0;
+}
+
+void RequestArena::add_block()
+{
+    // The header takes a whole max_align_t, so the free space
+    // after it is aligned like the block.
+    auto block = static_cast<Block*>(::operator new(m_block_size));
+    block->next = m_blocks;
+    m_blocks = block;
+    m_pos = reinterpret_cast<char*>(block) + sizeof(std::max_align_t);
+    m_end = reinterpret_cast<char*>(block) + m_block_size;
+}
+
+}   // nerd
@@ -0,0 +1,114 @@
+#ifndef NERD_REQUEST_ARENA_H
+#define NERD_REQUEST_ARENA_H
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include <boost/beast/http.hpp>
+
+#include "names.h"
+
+namespace nerd {
+
+// Monotonic memory for the header fields and body of one request.
+// Allocation bumps a pointer, deallocation does nothing and reset()
+// releases everything at once. The first block is kept by reset(), so a
+// connection reuses it for request after request without touching the
+// heap. Allocations larger than a quarter block (large bodies) go
+// straight to the heap and are freed by deallocate(), so a growing body
+// doesn't leave its old buffers in the arena.
+// Not thread-safe; a connection handles one request at a time.
+class RequestArena {
+public:
+    static constexpr std::size_t default_block_size = 8 << 10;
+
+    explicit RequestArena(std::size_t block_size = default_block_size);
+    ~RequestArena();
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t align);
+    void deallocate(void* p, std::size_t size);
+
+    // Release all memory but the first block. Everything allocated
+    // has to be destroyed before.
+    void reset();
+
+    // Since the last reset(): number of allocations, bytes allocated and
+    // number of those allocations that needed the heap (new blocks and
+    // large allocations).
+    std::size_t allocations() const { return m_allocations; }
+    std::size_t bytes() const { return m_bytes; }
+    std::size_t heap_allocations() const { return m_heap_allocations; }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    bool is_large(std::size_t size) const { return size > m_block_size / 4; }
+
+    // Start a new block and make it current.
+    void add_block();
+
+    std::size_t m_block_size;
+    Block* m_blocks = nullptr;      // current block first, the kept one last
+    char* m_pos = nullptr;          // free space of the current block
+    char* m_end = nullptr;
+    std::size_t m_allocations = 0;
+    std::size_t m_bytes = 0;
+    std::size_t m_heap_allocations = 0;
+};
+
+// Standard allocator on a RequestArena, for basic_fields and bodies.
+template<class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit ArenaAllocator(RequestArena& arena) : m_arena(&arena) {}
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.arena()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        m_arena->deallocate(p, n * sizeof(T));
+    }
+
+    RequestArena* arena() const { return m_arena; }
+
+private:
+    RequestArena* m_arena;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+// Requests as read by a connection, with all their memory in its arena.
+using ArenaStringBody = http::basic_string_body<
+    char, std::char_traits<char>, ArenaAllocator<char>>;
+using ArenaRequestParser = http::request_parser<ArenaStringBody, ArenaAllocator<char>>;
+
+}   // nerd
+
+#endif  // NERD_REQUEST_ARENA_H
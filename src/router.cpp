@@ -0,0 +1,184 @@
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "router.h"
+
+namespace {
+
+// Split off the next segment of `path`, which must start with '/'.
+// Returns the segment and leaves the remainder in `path`.
+beast::string_view next_segment(beast::string_view& path)
+{
+    path.remove_prefix(1);  // leading '/'
+    auto pos = path.find('/');
+    if (pos == beast::string_view::npos)
+        pos = path.size();
+    auto segment = path.substr(0, pos);
+    path.remove_prefix(pos);
+    return segment;
+}
+
+bool is_param(beast::string_view segment)
+{
+    return segment.size() >= 2 && segment.front() == '{' && segment.back() == '}';
+}
+
+}
+
+namespace nerd {
+
+constexpr int Router::max_params;
+
+Router::Router()
+    : m_nodes(1)
+{
+}
+
+void Router::add(http::verb method, beast::string_view pattern, int route)
+{
+    if (pattern.empty() || pattern[0] != '/')
+        throw std::invalid_argument("route pattern must start with '/'");
+
+    int node = 0;
+    int n_params = 0;
+    while (!pattern.empty()) {
+        auto segment = next_segment(pattern);
+        int child;
+        if (is_param(segment)) {
+            if (++n_params > max_params)
+                throw std::invalid_argument("too many route parameters");
+            child = m_nodes[node].param_child;
+            if (child < 0) {
+                child = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].param_child = child;
+            }
+        } else {
+            child = find_child(m_nodes[node], segment);
+            if (child < 0) {
+                child = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[child].segment = std::string(segment);
+                m_nodes[node].children.push_back(child);
+            }
+        }
+        node = child;
+    }
+
+    m_nodes[node].routes.emplace_back(method, route);
+}
+
+bool Router::match(http::verb method, beast::string_view target, Match& m) const
+{
+    auto path = target;
+    auto qpos = target.find('?');
+    if (qpos != beast::string_view::npos) {
+        path = target.substr(0, qpos);
+        m.query = target.substr(qpos + 1);
+    }
+    if (path.empty() || path[0] != '/')
+        return false;
+
+    int node = 0;
+    while (!path.empty()) {
+        auto segment = next_segment(path);
+        int child = find_child(m_nodes[node], segment);
+        if (child < 0) {
+            child = m_nodes[node].param_child;
+            if (child < 0 || m.n_params == max_params
+                || !parse_id(segment, m.params[m.n_params]))
+                return false;
+            ++m.n_params;
+        }
+        node = child;
+    }
+
+    const auto& routes = m_nodes[node].routes;
+    m.path_found = !routes.empty();
+    for (const auto& r : routes) {
+        if (r.first == method) {
+            m.route = r.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+int Router::find_child(const Node& node, beast::string_view segment) const
+{
+    for (int child : node.children) {
+        if (segment == m_nodes[child].segment)
+            return child;
+    }
+    return -1;
+}
+
+
+beast::string_view query_param(beast::string_view query, beast::string_view name)
+{
+    while (!query.empty()) {
+        auto end = query.find('&');
+        auto pair = query.substr(0, end);
+        auto eq = pair.find('=');
+        if (pair.substr(0, eq) == name)
+            return eq == beast::string_view::npos
+                ? beast::string_view{} : pair.substr(eq + 1);
+        if (end == beast::string_view::npos)
+            break;
+        query.remove_prefix(end + 1);
+    }
+    return {};
+}
+
+bool percent_decode(beast::string_view s, std::string& out)
+{
+    auto hex = [](char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    };
+
+    out.clear();
+    out.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (s[i] == '%') {
+            if (i + 2 >= s.size())
+                return false;
+            int hi = hex(s[i + 1]);
+            int lo = hex(s[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            out += static_cast<char>(hi * 16 + lo);
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return true;
+}
+
+bool parse_id(beast::string_view s, int& value)
+{
+    if (s.empty())
+        return false;
+
+    long long v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9')
+            return false;
+        v = v * 10 + (c - '0');
+        if (v > std::numeric_limits<int>::max())
+            return false;
+    }
+    value = static_cast<int>(v);
+    return true;
+}
+
+}   // nerd
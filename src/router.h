@@ -0,0 +1,69 @@
+#ifndef NERD_ROUTER_H
+#define NERD_ROUTER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "names.h"
+
+namespace nerd {
+
+// Maps method and request path to a route id.
+// The route table is built once; matching walks the path one segment at
+// a time through a trie and doesn't allocate.
+class Router {
+public:
+    static constexpr int max_params = 4;
+
+    struct Match {
+        int route = -1;             // registered id, -1 if nothing matched
+        bool path_found = false;    // path is known, but not for this method
+        int params[max_params];     // values of the {...} segments
+        int n_params = 0;
+        beast::string_view query;   // everything after '?', without it
+    };
+
+    Router();
+
+    // Register `route` for `method` and `pattern`, e.g. "/api/v1/cards/{id}".
+    // A "{...}" segment matches a non-negative int. Literal segments take
+    // precedence over parameters.
+    void add(http::verb method, beast::string_view pattern, int route);
+
+    // Match request target (path and optional query string).
+    // Returns true if a route was found for the method and path.
+    bool match(http::verb method, beast::string_view target, Match& m) const;
+
+private:
+    struct Node {
+        std::string segment;
+        std::vector<int> children;  // literal children, indices into m_nodes
+        int param_child = -1;
+        std::vector<std::pair<http::verb, int>> routes;
+    };
+
+    // Return index of the literal child with the given segment or -1.
+    int find_child(const Node& node, beast::string_view segment) const;
+
+    std::vector<Node> m_nodes;  // m_nodes[0] is the root
+};
+
+// Return the value of the first `name` parameter in a query string,
+// or an empty view. Values are not percent-decoded.
+beast::string_view query_param(beast::string_view query, beast::string_view name);
+
+// Decode a query parameter value: "%XX" escapes and '+' for space.
+// Returns false if an escape is malformed.
+bool percent_decode(beast::string_view s, std::string& out);
+
+// Parse a non-negative int made of digits only. Returns false on
+// empty input, other characters and overflow.
+bool parse_id(beast::string_view s, int& value);
+
+}   // nerd
+
+#endif  // NERD_ROUTER_H
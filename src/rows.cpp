@@ -0,0 +1,193 @@
+#include <stdexcept>
+#include <string>
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "rows.h"
+
+namespace nerd {
+
+namespace {
+
+// Fields of one object read so far, to reject repeated ones.
+class SeenFields {
+public:
+    // `bit` is the field's position in the list of accepted fields.
+    void add(JsonReader& in, unsigned bit, const std::string& key)
+    {
+        if (m_seen & (1u << bit))
+            in.fail("repeated field \"" + key + "\"");
+        m_seen |= 1u << bit;
+    }
+
+private:
+    unsigned m_seen = 0;
+};
+
+// Skip "id" and check "type". Returns false for any other key.
+bool read_common_field(JsonReader& in, SeenFields& seen, const std::string& key,
+                       const char* type, std::string& buffer)
+{
+    if (key == "id") {
+        seen.add(in, 0, key);
+        in.read_int();
+    } else if (key == "type") {
+        seen.add(in, 1, key);
+        in.read_string(buffer);
+        if (buffer != type)
+            in.fail(std::string("\"type\" has to be \"") + type + "\"");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void require_string(JsonReader& in, std::string& out)
+{
+    if (in.peek() != '"')
+        in.fail("expected string");
+    in.read_string(out);
+}
+
+}   // namespace
+
+void read_json(JsonReader& in, Card& card)
+{
+    card = Card();
+    SeenFields seen;
+    std::string key;
+    std::string buffer;
+    in.begin_object();
+    while (in.next_key(key)) {
+        if (read_common_field(in, seen, key, "card", buffer))
+            continue;
+        if (key == "title") {
+            seen.add(in, 2, key);
+            require_string(in, card.title);
+        } else if (key == "question") {
+            seen.add(in, 3, key);
+            require_string(in, card.question);
+        } else if (key == "answer") {
+            seen.add(in, 4, key);
+            card.has_answer = !in.read_null();
+            if (card.has_answer)
+                require_string(in, card.answer);
+        } else if (key == "topic") {
+            seen.add(in, 5, key);
+            card.topic = in.read_null() ? 0 : in.read_int();
+        } else {
+            in.fail("unknown field \"" + key + "\"");
+        }
+    }
+    if (card.title.empty())
+        throw std::invalid_argument("\"title\" is missing or empty");
+    if (card.question.empty())
+        throw std::invalid_argument("\"question\" is missing or empty");
+}
+
+void read_json(JsonReader& in, Topic& topic)
+{
+    topic = Topic();
+    SeenFields seen;
+    std::string key;
+    std::string buffer;
+    in.begin_object();
+    while (in.next_key(key)) {
+        if (read_common_field(in, seen, key, "topic", buffer))
+            continue;
+        if (key == "name") {
+            seen.add(in, 2, key);
+            require_string(in, topic.name);
+        } else {
+            in.fail("unknown field \"" + key + "\"");
+        }
+    }
+    if (topic.name.empty())
+        throw std::invalid_argument("\"name\" is missing or empty");
+}
+
+void parse_json(beast::string_view body, Card& card)
+{
+    JsonReader in(body);
+    read_json(in, card);
+    in.end();
+}
+
+void parse_json(beast::string_view body, Topic& topic)
+{
+    JsonReader in(body);
+    read_json(in, topic);
+    in.end();
+}
+
+void parse_json_list(beast::string_view body, std::vector<Card>& cards)
+{
+    cards.clear();
+    auto first = body.find_first_not_of(" \t\r\n");
+    if (first != beast::string_view::npos && body[first] == '[') {
+        JsonReader in(body);
+        in.begin_array();
+        while (in.next_element()) {
+            cards.emplace_back();
+            read_json(in, cards.back());
+        }
+        in.end();
+        return;
+    }
+
+    int line_no = 0;
+    while (!body.empty()) {
+        auto end = body.find('\n');
+        auto line = body.substr(0, end);
+        ++line_no;
+        if (line.find_first_not_of(" \t\r") != beast::string_view::npos) {
+            cards.emplace_back();
+            try {
+                parse_json(line, cards.back());
+            } catch (const std::invalid_argument& e) {
+                throw std::invalid_argument("line " + std::to_string(line_no) + ": " + e.what());
+            }
+        }
+        if (end == beast::string_view::npos)
+            break;
+        body.remove_prefix(end + 1);
+    }
+}
+
+void append_json(std::string& out, const CardSummary& card)
+{
+    out += R"({"id":)";
+    out += std::to_string(card.id);
+    out += R"(,"title":)";
+    append_json_string(out, card.title);
+    out += '}';
+}
+
+void append_json(std::string& out, const Card& card)
+{
+    out += R"({"id":)";
+    out += std::to_string(card.id);
+    out += R"(,"title":)";
+    append_json_string(out, card.title);
+    out += R"(,"question":)";
+    append_json_string(out, card.question);
+    out += R"(,"answer":)";
+    if (card.has_answer)
+        append_json_string(out, card.answer);
+    else
+        out += "null";
+    out += R"(,"topic":)";
+    out += std::to_string(card.topic);
+    out += '}';
+}
+
+void append_json(std::string& out, const Topic& topic)
+{
+    out += R"({"id":)";
+    out += std::to_string(topic.id);
+    out += R"(,"name":)";
+    append_json_string(out, topic.name);
+    out += '}';
+}
+
+}   // nerd
@@ -0,0 +1,77 @@
+#ifndef NERD_ROWS_H
+#define NERD_ROWS_H
+
+#include <string>
+#include <vector>
+
+#include "names.h"
+
+namespace nerd {
+
+class JsonReader;
+
+// Rows of the card and topic tables as plain structs, and their JSON
+// form written straight into an output buffer and read from request
+// bodies.
+
+// A card as listed: id and title only.
+struct CardSummary {
+    int id = 0;
+    std::string title;
+};
+
+struct Card {
+    int id = 0;
+    std::string title;
+    std::string question;
+    std::string answer;
+    bool has_answer = false;    // answer is NULL otherwise
+    int topic = 0;
+};
+
+struct Topic {
+    int id = 0;
+    std::string name;
+};
+
+// Append the row as JSON object to `out`. A card without answer
+// has "answer":null.
+void append_json(std::string& out, const CardSummary& card);
+void append_json(std::string& out, const Card& card);
+void append_json(std::string& out, const Topic& topic);
+
+// Read the object at the current position of `in` into the row.
+// Accepted are the fields a client sets: title, question, answer (string
+// or null) and topic (integer or null for the default topic 0) of a card,
+// name of a topic. "id" and "type" are skipped, so objects as returned by
+// GET and the export can be sent back. Unknown or repeated fields, wrong
+// types and a missing or empty title, question or name throw
+// std::invalid_argument.
+void read_json(JsonReader& in, Card& card);
+void read_json(JsonReader& in, Topic& topic);
+
+// Read the row from a request body holding just its object.
+void parse_json(beast::string_view body, Card& card);
+void parse_json(beast::string_view body, Topic& topic);
+
+// Read the cards of a JSON array or of one object per line (NDJSON).
+void parse_json_list(beast::string_view body, std::vector<Card>& cards);
+
+// Append the rows as JSON array to `out`.
+template<class Rows>
+void append_json_array(std::string& out, const Rows& rows)
+{
+    out += '[';
+    bool first = true;
+    for (const auto& row : rows) {
+        if (!first)
+            out += ',';
+        first = false;
+        append_json(out, row);
+    }
+    out += ']';
+}
+
+}   // nerd
+
+#endif  // NERD_ROWS_H
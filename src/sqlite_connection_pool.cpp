@@ -0,0 +1,153 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "sqlite_connection_pool.h"
+
+namespace {
+
+// Waits longer than this are reported on std::cerr.
+const std::chrono::milliseconds slow_wait{100};
+
+}
+
+namespace nerd {
+
+////////////////////////////////////////////////////////////////////////////////
+// SQLiteConnectionPool::Lease
+////////////////////////////////////////////////////////////////////////////////
+
+SQLiteConnectionPool::Lease::Lease(SQLiteConnectionPool& pool,
+                                   SQLiteDatabase& db, bool writer)
+    : m_pool{&pool}
+    , m_db{&db}
+    , m_writer{writer}
+{
+}
+
+SQLiteConnectionPool::Lease::Lease(Lease&& other)
+    : m_pool{other.m_pool}
+    , m_db{other.m_db}
+    , m_writer{other.m_writer}
+{
+    other.m_db = nullptr;
+}
+
+SQLiteConnectionPool::Lease::~Lease()
+{
+    if (m_db)
+        m_pool->release(*m_db, m_writer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SQLiteConnectionPool
+////////////////////////////////////////////////////////////////////////////////
+
+SQLiteConnectionPool::SQLiteConnectionPool(
+    const std::string& filename, int readers,
+    const SQLitePragmaProfile& profile)
+    : m_filename{filename}
+    , m_profile{profile}
+    , m_writer{filename.c_str(),
+               SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX}
+    , m_writer_busy{false}
+    , m_waits{0}
+    , m_wait_time_us{0}
+{
+    // The journal mode is persistent, so it is set through
+    // the writer before the readers are opened.
+    m_writer.apply(profile);
+    m_writer.migrate();
+
+    // Each connection is used by one thread at a time,
+    // so SQLite doesn't need to serialize access itself.
+    for (int i = 0; i < readers; ++i) {
+        m_readers.emplace_back(new SQLiteDatabase(open_reader()));
+        m_free_readers.push_back(m_readers.back().get());
+    }
+}
+
+SQLiteDatabase SQLiteConnectionPool::open_reader() const
+{
+    SQLiteDatabase db{m_filename.c_str(),
+                      SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX};
+    db.apply(m_profile);
+    return db;
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::reader()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_free_readers.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        m_reader_freed.wait(lock, [this] { return !m_free_readers.empty(); });
+        record_wait(start, "reader");
+    }
+
+    SQLiteDatabase* db = m_free_readers.back();
+    m_free_readers.pop_back();
+    return Lease(*this, *db, false);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::writer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_writer_busy) {
+        auto start = std::chrono::steady_clock::now();
+        m_writer_freed.wait(lock, [this] { return !m_writer_busy; });
+        record_wait(start, "writer");
+    }
+
+    m_writer_busy = true;
+    return Lease(*this, m_writer, true);
+}
+
+void SQLiteConnectionPool::release(SQLiteDatabase& db, bool writer)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (writer)
+            m_writer_busy = false;
+        else
+            m_free_readers.push_back(&db);
+    }
+
+    if (writer)
+        m_writer_freed.notify_one();
+    else
+        m_reader_freed.notify_one();
+}
+
+void SQLiteConnectionPool::record_wait(
+    std::chrono::steady_clock::time_point start, const char* what)
+{
+    auto waited = std::chrono::steady_clock::now() - start;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+    ++m_waits;
+    m_wait_time_us += us;
+
+    if (waited > slow_wait)
+        std::cerr << "connection pool exhausted: waited " << us
+                  << " us for " << what << " connection\n";
+}
+
+unsigned long SQLiteConnectionPool::statement_cache_hits() const
+{
+    unsigned long hits = m_writer.statement_cache().hits();
+    for (const auto& reader : m_readers)
+        hits += reader->statement_cache().hits();
+    return hits;
+}
+
+unsigned long SQLiteConnectionPool::statement_cache_misses() const
+{
+    unsigned long misses = m_writer.statement_cache().misses();
+    for (const auto& reader : m_readers)
+        misses += reader->statement_cache().misses();
+    return misses;
+}
+
+}   // nerd
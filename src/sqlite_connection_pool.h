@@ -0,0 +1,98 @@
+#ifndef NERD_SQLITE_CONNECTION_POOL_H
+#define NERD_SQLITE_CONNECTION_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sqlite_database.h"
+#include "sqlite_pragma_profile.h"
+
+namespace nerd {
+
+// A fixed set of connections to one database file: several read-only
+// connections and a single writer. With the default pragma profile the
+// database is switched to WAL mode, so readers never block on the writer.
+class SQLiteConnectionPool {
+public:
+    // Exclusive access to one connection; returned to the pool on destruction.
+    class Lease {
+    public:
+        Lease(SQLiteConnectionPool& pool, SQLiteDatabase& db, bool writer);
+        Lease(Lease&& other);
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease();
+
+        SQLiteDatabase& operator*() const { return *m_db; }
+        SQLiteDatabase* operator->() const { return m_db; }
+
+    private:
+        SQLiteConnectionPool* m_pool;
+        SQLiteDatabase* m_db;
+        bool m_writer;
+    };
+
+    // Open `readers` read-only connections and one writer connection
+    // and apply the pragma profile to each of them. The schema is
+    // migrated through the writer before the readers are opened.
+    // Throws if any connection cannot be opened.
+    SQLiteConnectionPool(
+        const std::string& filename, int readers,
+        const SQLitePragmaProfile& profile = SQLitePragmaProfile());
+
+    SQLiteConnectionPool(const SQLiteConnectionPool&) = delete;
+    SQLiteConnectionPool& operator=(const SQLiteConnectionPool&) = delete;
+
+    // Block until a read-only connection is free.
+    Lease reader();
+
+    // Block until the writer connection is free.
+    Lease writer();
+
+    // Open a new read-only connection outside the pool, set up like the
+    // pooled readers. For reads that outlive a request handler, such as
+    // a streamed export, so they don't keep a pooled reader leased.
+    SQLiteDatabase open_reader() const;
+
+    // Number of times a caller had to wait for a connection
+    // and the accumulated waiting time.
+    unsigned long waits() const { return m_waits; }
+    unsigned long long wait_time_us() const { return m_wait_time_us; }
+
+    // Statement cache hits and misses, summed over all connections.
+    unsigned long statement_cache_hits() const;
+    unsigned long statement_cache_misses() const;
+
+private:
+    void release(SQLiteDatabase& db, bool writer);
+
+    // Account for the time spent waiting since `start`.
+    void record_wait(std::chrono::steady_clock::time_point start,
+                     const char* what);
+
+    std::string m_filename;
+    SQLitePragmaProfile m_profile;
+
+    SQLiteDatabase m_writer;
+    std::vector<std::unique_ptr<SQLiteDatabase>> m_readers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_reader_freed;
+    std::condition_variable m_writer_freed;
+    std::vector<SQLiteDatabase*> m_free_readers;
+    bool m_writer_busy;
+
+    std::atomic<unsigned long> m_waits;
+    std::atomic<unsigned long long> m_wait_time_us;
+};
+
+}   // nerd
+
+#endif  // NERD_SQLITE_CONNECTION_POOL_H
@@ -9,9 +9,9 @@
 
 namespace nerd {
 
-SQLiteDatabase::SQLiteDatabase(const char* filename)
+SQLiteDatabase::SQLiteDatabase(const char* filename, int flags)
 {
-    int rc = sqlite3_open(filename, &m_db);
+    int rc = sqlite3_open_v2(filename, &m_db, flags, nullptr);
     if (rc != SQLITE_OK)
         throw std::runtime_error(
             std::string("cannot open database: ") + sqlite3_errmsg(m_db));
@@ -20,26 +20,92 @@ SQLiteDatabase::SQLiteDatabase(const char* filename)
     if (stmt.step() != SQLITE_DONE)
         throw std::runtime_error(
             std::string("cannot set foreign_keys pragma: ") + sqlite3_errmsg(m_db));
+
+    m_stmt_cache.reset(new SQLiteStatementCache(m_db));
 }
 
 SQLiteDatabase::SQLiteDatabase(SQLiteDatabase&& other)
     : m_db{other.m_db}
+    , m_stmt_cache{std::move(other.m_stmt_cache)}
+    , m_after_commit{std::move(other.m_after_commit)}
 {
     other.m_db = nullptr;
 }
 
 SQLiteDatabase::~SQLiteDatabase()
 {
+    // Cached statements have to be finalized before closing.
+    m_stmt_cache.reset();
     if (sqlite3_close(m_db))
         throw std::runtime_error(std::string("cannot close database: ")
                                  + sqlite3_errmsg(m_db));
 }
 
+void SQLiteDatabase::execute(const std::string& sql)
+{
+    SQLiteStatement stmt(m_db, *m_stmt_cache, sql);
+    if (stmt.step() != SQLITE_DONE)
+        throw std::runtime_error("cannot execute " + sql + ": " + sqlite3_errmsg(m_db));
+}
+
+void SQLiteDatabase::after_commit(std::function<void()> callback)
+{
+    if (sqlite3_get_autocommit(m_db))
+        callback();
+    else
+        m_after_commit.push_back(std::move(callback));
+}
+
+void SQLiteDatabase::discard_after_commit()
+{
+    m_after_commit.clear();
+}
+
+void SQLiteDatabase::run_after_commit()
+{
+    std::vector<std::function<void()>> callbacks;
+    callbacks.swap(m_after_commit);
+    for (auto& callback : callbacks)
+        callback();
+}
+
 sqlite3* SQLiteDatabase::data() const
 {
     return m_db;
 }
 
+SQLiteStatementCache& SQLiteDatabase::statement_cache() const
+{
+    return *m_stmt_cache;
+}
+
+void SQLiteDatabase::apply(const SQLitePragmaProfile& profile)
+{
+    const bool readonly = sqlite3_db_readonly(m_db, "main") == 1;
+    for (const auto& p : profile.pragmas()) {
+        if (readonly && p.first == "journal_mode")
+            continue;
+
+        // Some pragmas report their new value as a result row.
+        SQLiteStatement stmt(m_db, "PRAGMA " + p.first + " = " + p.second + ";");
+        int rc;
+        while ((rc = stmt.step()) == SQLITE_ROW)
+            ;
+        if (rc != SQLITE_DONE)
+            throw std::runtime_error("cannot set " + p.first + " pragma: "
+                                     + sqlite3_errmsg(m_db));
+    }
+}
+
+std::string SQLiteDatabase::pragma(const std::string& name) const
+{
+    SQLiteStatement stmt(m_db, "PRAGMA " + name + ";");
+    if (stmt.step() != SQLITE_ROW)
+        throw std::runtime_error("cannot read " + name + " pragma: "
+                                 + sqlite3_errmsg(m_db));
+    return stmt.column_text(0);
+}
+
 void SQLiteDatabase::init()
 {
     const std::vector<std::string> raw_stmts = {
@@ -66,10 +132,78 @@ void SQLiteDatabase::init()
                 -- see: https://www.sqlite.org/foreignkeys.html
         )RAW"};
 
+    execute_all(raw_stmts, "initialization");
+    execute_all(search_index_schema(), "initialization");
+}
+
+void SQLiteDatabase::migrate()
+{
+    {   // Nothing to do for databases that are up to date or not created yet.
+        SQLiteStatement stmt(
+            m_db,
+            R"RAW(SELECT sum(name = 'card'), sum(name = 'card_fts')
+                    FROM sqlite_master WHERE type = 'table';)RAW");
+        if (stmt.step() != SQLITE_ROW)
+            throw std::runtime_error(std::string("error during migration: ")
+                                     + sqlite3_errmsg(m_db));
+        if (stmt.column_int(0) == 0 || stmt.column_int(1) > 0)
+            return;
+    }
+
+    // Index the existing cards in the same transaction.
+    execute("BEGIN IMMEDIATE;");
+    try {
+        execute_all(search_index_schema(), "migration");
+        execute(R"RAW(INSERT INTO card_fts (card_fts) VALUES ('rebuild');)RAW");
+        execute("COMMIT;");
+    } catch (...) {
+        execute("ROLLBACK;");
+        throw;
+    }
+}
+
+const std::vector<std::string>& SQLiteDatabase::search_index_schema()
+{
+    // External content table: the text is stored in card only.
+    static const std::vector<std::string> raw_stmts = {
+        R"RAW(
+            CREATE VIRTUAL TABLE IF NOT EXISTS card_fts USING fts5(
+                title, question, answer,
+                content = 'card', content_rowid = 'id',
+                tokenize = 'unicode61 remove_diacritics 2'
+            );
+        )RAW",
+        R"RAW(
+            CREATE TRIGGER IF NOT EXISTS card_fts_insert AFTER INSERT ON card BEGIN
+                INSERT INTO card_fts (rowid, title, question, answer)
+                    VALUES (new.id, new.title, new.question, new.answer);
+            END;
+        )RAW",
+        R"RAW(
+            CREATE TRIGGER IF NOT EXISTS card_fts_delete AFTER DELETE ON card BEGIN
+                INSERT INTO card_fts (card_fts, rowid, title, question, answer)
+                    VALUES ('delete', old.id, old.title, old.question, old.answer);
+            END;
+        )RAW",
+        R"RAW(
+            CREATE TRIGGER IF NOT EXISTS card_fts_update
+            AFTER UPDATE OF title, question, answer ON card BEGIN
+                INSERT INTO card_fts (card_fts, rowid, title, question, answer)
+                    VALUES ('delete', old.id, old.title, old.question, old.answer);
+                INSERT INTO card_fts (rowid, title, question, answer)
+                    VALUES (new.id, new.title, new.question, new.answer);
+            END;
+        )RAW"};
+    return raw_stmts;
+}
+
+void SQLiteDatabase::execute_all(const std::vector<std::string>& raw_stmts,
+                                 const char* what)
+{
     for (const auto& raw : raw_stmts) {
         SQLiteStatement stmt(m_db, raw);
         if (stmt.step() != SQLITE_DONE)
-            throw std::runtime_error(std::string("error during initialization: ")
+            throw std::runtime_error(std::string("error during ") + what + ": "
                                      + sqlite3_errmsg(m_db));
     }
 }
@@ -1,13 +1,24 @@
 #ifndef NERD_SQLITE_DATABASE_H
 #define NERD_SQLITE_DATABASE_H
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <sqlite3.h>
 
+#include "sqlite_pragma_profile.h"
+#include "sqlite_statement.h"
+
 namespace nerd {
 
 class SQLiteDatabase {
 public:
-    explicit SQLiteDatabase(const char* filename);
+    // Open connection with the given sqlite3_open_v2 flags.
+    explicit SQLiteDatabase(
+        const char* filename,
+        int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 
     SQLiteDatabase(SQLiteDatabase&& other);
 
@@ -16,10 +27,45 @@ public:
     // Create database. Throw on error.
     void init();
 
+    // Bring a database created by an older version up to date.
+    // Throw on error.
+    void migrate();
+
+    // Apply all pragmas of the profile. The journal mode is left
+    // alone on read-only connections. Throw on error.
+    void apply(const SQLitePragmaProfile& profile);
+
+    // Return the current value of the pragma with the given name.
+    std::string pragma(const std::string& name) const;
+
+    // Execute a statement that returns no rows, e.g. "BEGIN;".
+    // Throw on error.
+    void execute(const std::string& sql);
+
+    // Run `callback` once the current transaction has ended, or right
+    // away if no explicit transaction is open. Whoever ends an explicit
+    // transaction has to call run_after_commit(), or
+    // discard_after_commit() if it was rolled back.
+    void after_commit(std::function<void()> callback);
+    void run_after_commit();
+    void discard_after_commit();
+
     sqlite3* data() const;
 
+    // Prepared statements of this connection.
+    SQLiteStatementCache& statement_cache() const;
+
 private:
+    // Statements creating the full-text index of cards and the
+    // triggers keeping it in sync.
+    static const std::vector<std::string>& search_index_schema();
+
+    // Step each statement, which must return no rows.
+    void execute_all(const std::vector<std::string>& raw_stmts, const char* what);
+
     sqlite3* m_db;
+    std::unique_ptr<SQLiteStatementCache> m_stmt_cache;
+    std::vector<std::function<void()>> m_after_commit;
 };
 
 }   // nerd
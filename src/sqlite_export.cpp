@@ -0,0 +1,88 @@
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <sqlite3.h>
+
+#include "sqlite_export.h"
+
+namespace nerd {
+
+////////////////////////////////////////////////////////////////////////////////
+// SQLiteExport
+////////////////////////////////////////////////////////////////////////////////
+
+SQLiteExport::SQLiteExport(SQLiteDatabase db)
+    : m_db{std::move(db)}
+    // No ORDER BY: it would sort both tables into temporary b-trees.
+    // SQLite runs the parts of a UNION ALL one after another, and a
+    // plain table scan returns rows in rowid (id) order.
+    , m_stmt{m_db.data(), m_db.statement_cache(),
+             R"RAW(SELECT 0 AS kind, id, name, NULL, NULL, NULL FROM topic
+                   UNION ALL
+                   SELECT 1 AS kind, id, title, question, answer, topic FROM card;)RAW"}
+    , m_done{false}
+{
+}
+
+bool SQLiteExport::write_json(std::string& out, std::size_t min_size)
+{
+    while (!m_done && out.size() < min_size) {
+        int rc = m_stmt.step();
+        if (rc == SQLITE_DONE) {
+            m_done = true;
+            break;
+        }
+        if (rc != SQLITE_ROW)
+            throw std::runtime_error(std::string("export failed: ")
+                                     + sqlite3_errmsg(m_db.data()));
+
+        if (m_stmt.column_int(0) == 0) {
+            out += R"({"type":"topic","id":)";
+            m_stmt.append_column_json(1, out);
+            out += R"(,"name":)";
+            m_stmt.append_column_json(2, out);
+        } else {
+            out += R"({"type":"card","id":)";
+            m_stmt.append_column_json(1, out);
+            out += R"(,"title":)";
+            m_stmt.append_column_json(2, out);
+            out += R"(,"question":)";
+            m_stmt.append_column_json(3, out);
+            out += R"(,"answer":)";
+            m_stmt.append_column_json(4, out);
+            out += R"(,"topic":)";
+            m_stmt.append_column_json(5, out);
+        }
+        out += "}\n";
+    }
+    return !m_done;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ExportBody
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr std::size_t ExportBody::chunk_size;
+
+boost::optional<std::pair<ExportBody::writer::const_buffers_type, bool>>
+ExportBody::writer::get(beast::error_code& ec)
+{
+    ec = {};
+    m_buffer.clear();
+    if (m_more) {
+        try {
+            m_more = m_dump.write_json(m_buffer, chunk_size);
+        } catch (const std::exception&) {
+            // The header is already sent; all we can do is abort.
+            ec = beast::errc::make_error_code(beast::errc::io_error);
+            return boost::none;
+        }
+    }
+    if (m_buffer.empty())
+        return boost::none;
+    return {{{m_buffer.data(), m_buffer.size()}, m_more}};
+}
+
+}   // nerd
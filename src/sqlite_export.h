@@ -0,0 +1,82 @@
+#ifndef NERD_SQLITE_EXPORT_H
+#define NERD_SQLITE_EXPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/optional.hpp>
+
+#include "names.h"
+#include "sqlite_database.h"
+#include "sqlite_statement.h"
+
+namespace nerd {
+
+// Dump of all topics and then all cards as NDJSON, one object per line:
+//   {"type":"topic","id":1,"name":"..."}
+//   {"type":"card","id":1,"title":"...","question":"...","answer":"...","topic":1}
+// The rows come from a single statement, so the dump is a consistent
+// snapshot, and are written in pieces, so memory use doesn't grow with
+// the size of the database.
+class SQLiteExport {
+public:
+    // The export owns its connection, so a slow client never holds
+    // one of the pool's readers.
+    explicit SQLiteExport(SQLiteDatabase db);
+
+    SQLiteExport(const SQLiteExport&) = delete;
+    SQLiteExport& operator=(const SQLiteExport&) = delete;
+
+    // Append lines to `out` until it holds at least `min_size` bytes
+    // or all rows are written. Returns false once all rows are written.
+    bool write_json(std::string& out, std::size_t min_size);
+
+private:
+    SQLiteDatabase m_db;
+    SQLiteStatement m_stmt;
+    bool m_done;
+};
+
+// HTTP body that streams an export. Without a known size the response
+// is sent with chunked transfer encoding.
+struct ExportBody {
+    using value_type = std::unique_ptr<SQLiteExport>;
+
+    // Approximate size of a chunk.
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    class writer {
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, value_type& dump)
+            : m_dump(*dump)
+            , m_more(true)
+        {
+        }
+
+        void init(beast::error_code& ec)
+        {
+            m_buffer.reserve(chunk_size + 4096);
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(beast::error_code& ec);
+
+    private:
+        SQLiteExport& m_dump;
+        std::string m_buffer;   // the chunk being sent
+        bool m_more;
+    };
+};
+
+}   // nerd
+
+#endif  // NERD_SQLITE_EXPORT_H
@@ -0,0 +1,106 @@
+#include <algorithm>    // find, transform
+#include <cctype>       // isspace, toupper
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sqlite_pragma_profile.h"
+
+namespace {
+
+std::string trim(const std::string& s)
+{
+    auto first = std::find_if_not(s.begin(), s.end(), ::isspace);
+    auto last = std::find_if_not(s.rbegin(), s.rend(), ::isspace).base();
+    return first < last ? std::string(first, last) : std::string();
+}
+
+// Pragma values are spliced into the SQL text, so only
+// known keywords are accepted for the non-numeric ones.
+std::string keyword(const std::string& key, const std::string& value,
+                    const std::vector<std::string>& allowed)
+{
+    std::string upper(value);
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (std::find(allowed.begin(), allowed.end(), upper) == allowed.end())
+        throw std::invalid_argument("invalid value for " + key + ": " + value);
+    return upper;
+}
+
+long long number(const std::string& key, const std::string& value)
+{
+    std::size_t pos;
+    long long n;
+    try {
+        n = std::stoll(value, &pos);
+    } catch (const std::exception&) {
+        pos = 0;
+    }
+    if (pos == 0 || pos != value.size())
+        throw std::invalid_argument("invalid value for " + key + ": " + value);
+    return n;
+}
+
+}
+
+namespace nerd {
+
+SQLitePragmaProfile SQLitePragmaProfile::from_file(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("cannot read pragma profile: " + filename);
+
+    SQLitePragmaProfile profile;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        profile.set(line);
+    }
+    return profile;
+}
+
+void SQLitePragmaProfile::set(const std::string& key, const std::string& value)
+{
+    if (key == "journal_mode")
+        journal_mode = keyword(key, value,
+            {"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF"});
+    else if (key == "synchronous")
+        synchronous = keyword(key, value, {"OFF", "NORMAL", "FULL", "EXTRA"});
+    else if (key == "cache_size")
+        cache_size = number(key, value);
+    else if (key == "mmap_size")
+        mmap_size = number(key, value);
+    else if (key == "temp_store")
+        temp_store = keyword(key, value, {"DEFAULT", "FILE", "MEMORY"});
+    else if (key == "busy_timeout")
+        busy_timeout = number(key, value);
+    else
+        throw std::invalid_argument("unknown pragma: " + key);
+}
+
+void SQLitePragmaProfile::set(const std::string& assignment)
+{
+    auto pos = assignment.find('=');
+    if (pos == std::string::npos)
+        throw std::invalid_argument("expected key=value: " + assignment);
+    set(trim(assignment.substr(0, pos)), trim(assignment.substr(pos + 1)));
+}
+
+std::vector<std::pair<std::string, std::string>> SQLitePragmaProfile::pragmas() const
+{
+    return {
+        {"journal_mode", journal_mode},
+        {"synchronous", synchronous},
+        {"cache_size", std::to_string(cache_size)},
+        {"mmap_size", std::to_string(mmap_size)},
+        {"temp_store", temp_store},
+        {"busy_timeout", std::to_string(busy_timeout)}
+    };
+}
+
+}   // nerd
@@ -0,0 +1,37 @@
+#ifndef NERD_SQLITE_PRAGMA_PROFILE_H
+#define NERD_SQLITE_PRAGMA_PROFILE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nerd {
+
+// PRAGMA settings applied to every connection when it is opened.
+// The defaults favour concurrent readers and cheap commits.
+struct SQLitePragmaProfile {
+    std::string journal_mode = "WAL";
+    std::string synchronous = "NORMAL";
+    long long cache_size = -8192;       // negative: KiB, positive: pages
+    long long mmap_size = 64 << 20;     // bytes
+    std::string temp_store = "MEMORY";
+    long long busy_timeout = 5000;      // milliseconds
+
+    // Read a profile from a file with one "key = value" pair per line.
+    // Empty lines and lines starting with '#' are ignored.
+    // Throws on unreadable files and invalid settings.
+    static SQLitePragmaProfile from_file(const std::string& filename);
+
+    // Change a single setting. Throws on unknown keys and invalid values.
+    void set(const std::string& key, const std::string& value);
+
+    // Same as set() for a "key=value" string.
+    void set(const std::string& assignment);
+
+    // The PRAGMA statements for this profile, as (name, value) pairs.
+    std::vector<std::pair<std::string, std::string>> pragmas() const;
+};
+
+}   // nerd
+
+#endif  // NERD_SQLITE_PRAGMA_PROFILE_H
@@ -1,13 +1,77 @@
+#include <chrono>
+#include <cstdio>     // snprintf
 #include <limits>
 #include <stdexcept>
 #include <string>
 
+#include "json_writer.h"
+#include "metrics.h"
 #include "sqlite_statement.h"
 
 namespace nerd {
 
+////////////////////////////////////////////////////////////////////////////////
+// SQLiteStatementCache
+////////////////////////////////////////////////////////////////////////////////
+
+SQLiteStatementCache::SQLiteStatementCache(sqlite3* db)
+    : m_db{db}
+    , m_hits{0}
+    , m_misses{0}
+{
+}
+
+SQLiteStatementCache::~SQLiteStatementCache()
+{
+    for (auto& entry : m_stmts) {
+        for (sqlite3_stmt* stmt : entry.second)
+            sqlite3_finalize(stmt);
+    }
+}
+
+sqlite3_stmt* SQLiteStatementCache::acquire(const std::string& stmt_str, Idle*& idle)
+{
+    // The entry stays when its statements are in use, so the key
+    // is only allocated the first time.
+    idle = &m_stmts[stmt_str];
+    if (!idle->empty()) {
+        sqlite3_stmt* stmt = idle->back();
+        idle->pop_back();
+        m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return stmt;
+    }
+
+    m_misses.store(m_misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v3(
+        m_db,
+        stmt_str.c_str(),
+        -1,     // read until null-terminator
+        SQLITE_PREPARE_PERSISTENT,
+        &stmt,
+        nullptr);
+    if (rc != SQLITE_OK)
+        throw std::runtime_error(
+            std::string("preparing SQL statement failed: ") + sqlite3_errmsg(m_db));
+    return stmt;
+}
+
+void SQLiteStatementCache::release(sqlite3_stmt* stmt, Idle& idle)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    idle.push_back(stmt);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SQLiteStatement
+////////////////////////////////////////////////////////////////////////////////
+
 SQLiteStatement::SQLiteStatement(sqlite3* db, const std::string& stmt_str)
     : m_db{db}
+    , m_cache{nullptr}
+    , m_idle{nullptr}
 {
     int rc = sqlite3_prepare_v2(
         m_db,
@@ -20,14 +84,43 @@ SQLiteStatement::SQLiteStatement(sqlite3* db, const std::string& stmt_str)
             std::string("preparing SQL statement failed: ") + sqlite3_errmsg(m_db));
 }
 
+SQLiteStatement::SQLiteStatement(sqlite3* db, SQLiteStatementCache& cache,
+                                 const std::string& stmt_str)
+    : m_db{db}
+    , m_cache{&cache}
+{
+    m_stmt = cache.acquire(stmt_str, m_idle);
+}
+
+SQLiteStatement::SQLiteStatement(SQLiteStatement&& other)
+    : m_db{other.m_db}
+    , m_stmt{other.m_stmt}
+    , m_cache{other.m_cache}
+    , m_idle{other.m_idle}
+{
+    other.m_stmt = nullptr;
+}
+
 SQLiteStatement::~SQLiteStatement()
 {
-    sqlite3_finalize(m_stmt);
+    if (m_cache && m_stmt)
+        m_cache->release(m_stmt, *m_idle);
+    else
+        sqlite3_finalize(m_stmt);
 }
 
 int SQLiteStatement::step()
 {
-    return sqlite3_step(m_stmt);
+    auto start = std::chrono::steady_clock::now();
+    int rc = sqlite3_step(m_stmt);
+    Metrics::instance().record_sqlite_step(std::chrono::steady_clock::now() - start);
+    return rc;
+}
+
+void SQLiteStatement::reset()
+{
+    sqlite3_reset(m_stmt);
+    sqlite3_clear_bindings(m_stmt);
 }
 
 
@@ -48,21 +141,44 @@ void SQLiteStatement::bind_int(int pos, int val)
         throw std::runtime_error(std::string("bind_int failed: ") + sqlite3_errmsg(m_db));
 }
 
-void SQLiteStatement::bind_text(int pos, const std::string& text)
+void SQLiteStatement::bind_int64(int pos, sqlite3_int64 val)
+{
+    int rc = sqlite3_bind_int64(m_stmt, pos, val);
+    if (rc != SQLITE_OK)
+        throw std::runtime_error(std::string("bind_int64 failed: ") + sqlite3_errmsg(m_db));
+}
+
+void SQLiteStatement::bind_text(int pos, beast::string_view text, Lifetime lifetime)
 {
     if (text.size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
         throw std::invalid_argument("String too long."); 
     }
 
+    // The explicit length saves SQLite a strlen.
     int rc = sqlite3_bind_text(
-        m_stmt, pos, text.c_str(),
-        -1 /* null-terminated */, SQLITE_TRANSIENT);
+        m_stmt, pos, text.data(), static_cast<int>(text.size()),
+        lifetime == Lifetime::transient ? SQLITE_TRANSIENT : SQLITE_STATIC);
 
     if (rc != SQLITE_OK)
         throw std::runtime_error(std::string("bind_text failed: ") + sqlite3_errmsg(m_db));
     // TODO Don't use exception. Use std::optional instead as return value.
 }
 
+void SQLiteStatement::bind_blob(int pos, const void* data, std::size_t size,
+                                Lifetime lifetime)
+{
+    if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        throw std::invalid_argument("Blob too long.");
+    }
+
+    int rc = sqlite3_bind_blob(
+        m_stmt, pos, data, static_cast<int>(size),
+        lifetime == Lifetime::transient ? SQLITE_TRANSIENT : SQLITE_STATIC);
+
+    if (rc != SQLITE_OK)
+        throw std::runtime_error(std::string("bind_blob failed: ") + sqlite3_errmsg(m_db));
+}
+
 //////////////////////////////
 // column functions
 //////////////////////////////
@@ -74,11 +190,53 @@ int SQLiteStatement::column_int(int pos)
 
 std::string SQLiteStatement::column_text(int pos)
 {
-    const unsigned char* ptr = sqlite3_column_text(m_stmt, pos);
-    if (ptr)
-        return std::string(reinterpret_cast<const char*>(ptr));
-    else
+    if (column_is_null(pos))
         throw SQLiteColumnNull();
+    return std::string(column_text_view(pos));
+}
+
+beast::string_view SQLiteStatement::column_text_view(int pos)
+{
+    // sqlite3_column_bytes has to be called after sqlite3_column_text.
+    auto ptr = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, pos));
+    if (!ptr)
+        return {};
+    return beast::string_view(ptr, sqlite3_column_bytes(m_stmt, pos));
+}
+
+bool SQLiteStatement::column_is_null(int pos)
+{
+    return sqlite3_column_type(m_stmt, pos) == SQLITE_NULL;
+}
+
+int SQLiteStatement::column_count()
+{
+    return sqlite3_column_count(m_stmt);
+}
+
+const char* SQLiteStatement::column_name(int pos)
+{
+    return sqlite3_column_name(m_stmt, pos);
+}
+
+void SQLiteStatement::append_column_json(int pos, std::string& out)
+{
+    switch (sqlite3_column_type(m_stmt, pos)) {
+    case SQLITE_NULL:
+        out += "null";
+        break;
+    case SQLITE_INTEGER:
+        out += std::to_string(sqlite3_column_int64(m_stmt, pos));
+        break;
+    case SQLITE_FLOAT: {
+        char buf[32];
+        std::snprintf(buf, sizeof buf, "%.17g", sqlite3_column_double(m_stmt, pos));
+        out += buf;
+        break;
+    }
+    default:
+        append_json_string(out, column_text_view(pos));
+    }
 }
 
 }   // nerd
@@ -1,33 +1,101 @@
 #ifndef NERD_SQLITE_STATEMENT_H
 #define NERD_SQLITE_STATEMENT_H
 
+#include <atomic>
+#include <cstddef>
 #include <exception>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include <boost/beast/core.hpp>
 #include <sqlite3.h>
 
+#include "names.h"
+
 namespace nerd {
 
 class SQLiteColumnNull : public std::exception {
 };
 
+// Prepared statements of a single connection, keyed by their SQL text.
+// A statement handed out by acquire() is used exclusively by the caller
+// until it is given back by release(). Like the connection, the cache is
+// used by one thread at a time; only the counters may be read by others.
+class SQLiteStatementCache {
+public:
+    // Idle statements prepared from the same SQL text.
+    using Idle = std::vector<sqlite3_stmt*>;
+
+    explicit SQLiteStatementCache(sqlite3* db);
+
+    SQLiteStatementCache(const SQLiteStatementCache&) = delete;
+    SQLiteStatementCache& operator=(const SQLiteStatementCache&) = delete;
+
+    // Finalizes all cached statements.
+    ~SQLiteStatementCache();
+
+    // Return a prepared statement for the given SQL text and the list
+    // it has to be released to. Throws if the statement cannot be prepared.
+    sqlite3_stmt* acquire(const std::string& stmt_str, Idle*& idle);
+
+    // Reset the statement, clear its bindings and keep it for reuse.
+    // Neither allocates once the statement's SQL text has been seen.
+    void release(sqlite3_stmt* stmt, Idle& idle);
+
+    // Number of acquire() calls that found an idle statement
+    // and that had to prepare one.
+    unsigned long hits() const { return m_hits.load(std::memory_order_relaxed); }
+    unsigned long misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+private:
+    sqlite3* m_db;
+    std::unordered_map<std::string, Idle> m_stmts;  // nodes never move
+    std::atomic<unsigned long> m_hits;
+    std::atomic<unsigned long> m_misses;
+};
+
 class SQLiteStatement {
 public:
     SQLiteStatement(sqlite3* db, const std::string& stmt_str);
 
+    // Take the prepared statement from the cache and give it back on
+    // destruction instead of finalizing it.
+    SQLiteStatement(sqlite3* db, SQLiteStatementCache& cache,
+                    const std::string& stmt_str);
+
+    SQLiteStatement(SQLiteStatement&& other);
+
+    SQLiteStatement(const SQLiteStatement&) = delete;
+    SQLiteStatement& operator=(const SQLiteStatement&) = delete;
+
     ~SQLiteStatement();
 
     int step();
 
+    // Make the statement ready to be bound and stepped again.
+    void reset();
+
 
     //////////////////////////////
     // bind functions
     //////////////////////////////
 
+    // How long bound text and blob data stays valid.
+    enum class Lifetime {
+        transient,      // SQLite makes a private copy
+        caller_owned    // caller keeps the data unchanged until the
+                        // statement is stepped for the last time
+    };
+
     void bind_null(int pos);
     void bind_int(int pos, int val);
-    void bind_text(int pos, const std::string& text);
-    
+    void bind_int64(int pos, sqlite3_int64 val);
+    void bind_text(int pos, beast::string_view text,
+                   Lifetime lifetime = Lifetime::transient);
+    void bind_blob(int pos, const void* data, std::size_t size,
+                   Lifetime lifetime = Lifetime::transient);
+
 
     //////////////////////////////
     // column functions
@@ -35,11 +103,30 @@ public:
 
     int column_int(int pos);
 
+    // Throws SQLiteColumnNull if the value is NULL.
     std::string column_text(int pos);
 
+    // Text of the column without copying. The view is valid until the
+    // next step() or the destruction of the statement. NULL yields an
+    // empty view; use column_is_null() to tell it from an empty string.
+    beast::string_view column_text_view(int pos);
+
+    bool column_is_null(int pos);
+
+    int column_count();
+
+    // Name of the column as given in the statement (after "AS").
+    const char* column_name(int pos);
+
+    // Append the column value of the current row to `out` as JSON,
+    // straight from SQLite's buffer (number, string or null).
+    void append_column_json(int pos, std::string& out);
+
 private:
     sqlite3* m_db;
     sqlite3_stmt* m_stmt;
+    SQLiteStatementCache* m_cache;  // nullptr if not cached
+    SQLiteStatementCache::Idle* m_idle;
 };
 
 }   // nerd
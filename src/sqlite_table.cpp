@@ -1,46 +1,100 @@
+#include <algorithm>  // min
 #include <stdexcept>
 #include <string>
+#include <type_traits>  // extent
 #include <unordered_map>
+#include <vector>
 
 #include <json.hpp>
 #include <sqlite3.h>
 
+#include "json_writer.h"
 #include "sqlite_statement.h"
 #include "sqlite_table.h"
 
+namespace {
+
+// "a, b, c" for columns {"a", "b", "c"}.
+template<std::size_t N>
+std::string column_list(const char* const (&columns)[N])
+{
+    std::string list;
+    for (std::size_t i = 0; i < N; ++i) {
+        if (i > 0)
+            list += ", ";
+        list += columns[i];
+    }
+    return list;
+}
+
+}
+
 namespace nerd {
 
 ////////////////////////////////////////////////////////////////////////////////
 // SQLiteTable
 ////////////////////////////////////////////////////////////////////////////////
 
-SQLiteTable::SQLiteTable(sqlite3* db)
-: m_db(db) {}
+template<class Derived, class Row, class Summary>
+SQLiteTable<Derived, Row, Summary>::SQLiteTable(SQLiteDatabase& db)
+: m_database(db)
+, m_db(db.data())
+, m_stmt_cache(db.statement_cache()) {}
 
-int SQLiteTable::insert(const json& data)
+template<class Derived, class Row, class Summary>
+int SQLiteTable<Derived, Row, Summary>::insert(const Row& row)
 {
-    if (!data_is_valid(data))
+    if (!Derived::data_is_valid(row))
         throw std::runtime_error("insert: invalid data");
 
-    SQLiteStatement stmt = insert_statement(data);
+    SQLiteStatement stmt(m_db, m_stmt_cache, insert_sql());
+    Derived::bind_values(stmt, row);
 
     // Execute statement and return last-insert id.
     if (stmt.step() != SQLITE_DONE)
         throw std::runtime_error(std::string("cannot insert object: ") + sqlite3_errmsg(m_db));
 
+    derived().changed();
     return sqlite3_last_insert_rowid(m_db);
 }
 
-json SQLiteTable::get(const std::unordered_map<std::string, std::string>& filter) const
+template<class Derived, class Row, class Summary>
+std::pair<int, int> SQLiteTable<Derived, Row, Summary>::insert_many(const std::vector<Row>& rows)
+{
+    if (rows.empty())
+        throw std::runtime_error("insert_many: expected a non-empty array");
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        if (!Derived::data_is_valid(rows[i]))
+            throw std::runtime_error("insert_many: invalid data at index " + std::to_string(i));
+    }
+
+    SQLiteStatement stmt(m_db, m_stmt_cache, insert_sql());
+    int first_id = -1;
+    for (const auto& row : rows) {
+        Derived::bind_values(stmt, row);
+        if (stmt.step() != SQLITE_DONE)
+            throw std::runtime_error(std::string("cannot insert object: ") + sqlite3_errmsg(m_db));
+        if (first_id < 0)
+            first_id = sqlite3_last_insert_rowid(m_db);
+        stmt.reset();
+    }
+
+    derived().changed();
+    return {first_id, static_cast<int>(sqlite3_last_insert_rowid(m_db))};
+}
+
+template<class Derived, class Row, class Summary>
+std::vector<Summary> SQLiteTable<Derived, Row, Summary>::get(
+    const std::unordered_map<std::string, std::string>& filter) const
 {
-    SQLiteStatement stmt = get_statement(filter);
+    SQLiteStatement stmt = derived().get_statement(filter);
 
     // Fetch results.
-    json result = json::array();
+    std::vector<Summary> result;
     int rc;
     while ((rc = stmt.step()) == SQLITE_ROW) {
-        json obj = fetch_one_shallow(stmt);
-        result.push_back(obj);
+        result.emplace_back();
+        Derived::read_summary(stmt, result.back());
     }
 
     // Check for errors.
@@ -51,17 +105,104 @@ json SQLiteTable::get(const std::unordered_map<std::string, std::string>& filter
     return result;
 }
 
-json SQLiteTable::get_one(int id) const
+template<class Derived, class Row, class Summary>
+int SQLiteTable<Derived, Row, Summary>::write_json(
+    std::string& out,
+    const std::unordered_map<std::string, std::string>& filter,
+    std::size_t max_rows) const
 {
-    SQLiteStatement stmt = get_one_statement(id);
+    SQLiteStatement stmt = derived().get_statement(filter);
+
+    // One row object for all rows, so its strings keep their capacity.
+    Summary row;
+    out += '[';
+    int rc;
+    std::size_t rows = 0;
+    while ((rc = stmt.step()) == SQLITE_ROW) {
+        if (rows == max_rows) {
+            // There is at least one more row; continue after the last one.
+            out += ']';
+            return row.id;
+        }
+        if (rows > 0)
+            out += ',';
+        ++rows;
+        Derived::read_summary(stmt, row);
+        append_json(out, row);
+    }
+    out += ']';
+
+    // Check for errors.
+    if (rc != SQLITE_DONE)
+        throw std::runtime_error(std::string("fetching all objects from table failed: ")
+                                 + sqlite3_errmsg(m_db));
+
+    return -1;
+}
+
+template<class Derived, class Row, class Summary>
+bool SQLiteTable<Derived, Row, Summary>::write_rows_json(SQLiteStatement& stmt, std::string& out,
+                                           std::size_t max_rows, int& last_id) const
+{
+    // The selected column names are the object keys.
+    std::vector<std::string> keys;
+    for (int i = 0; i < stmt.column_count(); ++i) {
+        std::string key;
+        append_json_string(key, stmt.column_name(i));
+        key += ':';
+        keys.push_back(std::move(key));
+    }
+
+    // Fetch results.
+    out += '[';
+    int rc;
+    std::size_t rows = 0;
+    last_id = -1;
+    while ((rc = stmt.step()) == SQLITE_ROW) {
+        if (rows == max_rows) {
+            // There is at least one more row; continue after the last one.
+            out += ']';
+            return true;
+        }
+        if (rows > 0)
+            out += ',';
+        ++rows;
+        last_id = stmt.column_int(0);
+        out += '{';
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            if (i > 0)
+                out += ',';
+            out += keys[i];
+            stmt.append_column_json(i, out);
+        }
+        out += '}';
+    }
+    out += ']';
+
+    // Check for errors.
+    if (rc != SQLITE_DONE)
+        throw std::runtime_error(std::string("fetching all objects from table failed: ")
+                                 + sqlite3_errmsg(m_db));
+
+    return false;
+}
+
+template<class Derived, class Row, class Summary>
+Row SQLiteTable<Derived, Row, Summary>::get_one(int id) const
+{
+    SQLiteStatement stmt(m_db, m_stmt_cache, get_one_sql());
+    stmt.bind_int(1, id);
     {   // Execute statement.
-        int rc;
-        if ((rc = stmt.step()) != SQLITE_ROW) {
+        int rc = stmt.step();
+        if (rc == SQLITE_DONE)
+            throw std::out_of_range("no object with id " + std::to_string(id));
+        if (rc != SQLITE_ROW) {
             throw std::runtime_error(
                 std::string("error when fetching object with id ") + std::to_string(id));
         }
     }
-    json result = fetch_one_detailed(stmt);
+    Row result;
+    Derived::read_row(stmt, result);
 
     // Check for errors.
     if (stmt.step() != SQLITE_DONE)
@@ -70,154 +211,250 @@ json SQLiteTable::get_one(int id) const
     return result;
 }
 
-void SQLiteTable::update(int id, const json& data)
+template<class Derived, class Row, class Summary>
+void SQLiteTable<Derived, Row, Summary>::update(int id, const Row& row)
 {
-    if (!data_is_valid(data))
+    if (!Derived::data_is_valid(row))
         throw std::runtime_error("update: invalid_data");
 
-    SQLiteStatement stmt = update_statement(id, data);
+    // The id follows the values.
+    SQLiteStatement stmt(m_db, m_stmt_cache, update_sql());
+    Derived::bind_values(stmt, row);
+    stmt.bind_int(std::extent<decltype(Derived::value_columns)>::value + 1, id);
 
     // Execute statement.
     if (stmt.step() != SQLITE_DONE)
         throw std::runtime_error(std::string("cannot update object: ") + sqlite3_errmsg(m_db));
+    if (sqlite3_changes(m_db) > 0)
+        derived().changed();
 }
 
-void SQLiteTable::remove(int id)
+template<class Derived, class Row, class Summary>
+void SQLiteTable<Derived, Row, Summary>::remove(int id)
 {
-    SQLiteStatement stmt =
-        delete_statement(id);
+    SQLiteStatement stmt(m_db, m_stmt_cache, delete_sql());
+    stmt.bind_int(1, id);
     if (stmt.step() != SQLITE_DONE)
         throw std::runtime_error(std::string("cannot delete object: ") + sqlite3_errmsg(m_db));
+    if (sqlite3_changes(m_db) > 0)
+        derived().changed();
 }
 
-SQLiteStatement SQLiteTable::delete_statement(int id) const
+template<class Derived, class Row, class Summary>
+SQLiteStatement SQLiteTable<Derived, Row, Summary>::get_statement(
+    const std::unordered_map<std::string, std::string>&) const
 {
-    SQLiteStatement stmt(
-        m_db,
-        "DELETE FROM " + get_table_name() + " WHERE id = $1;");
-    stmt.bind_int(1, id);
+    static const std::string sql = list_sql() + ";";
+    return SQLiteStatement(m_db, m_stmt_cache, sql);
+}
 
-    return stmt;
+template<class Derived, class Row, class Summary>
+const std::string& SQLiteTable<Derived, Row, Summary>::list_sql()
+{
+    static const std::string sql =
+        "SELECT id, " + column_list(Derived::list_columns)
+        + " FROM " + Derived::table_name;
+    return sql;
 }
 
+template<class Derived, class Row, class Summary>
+const std::string& SQLiteTable<Derived, Row, Summary>::get_one_sql()
+{
+    static const std::string sql =
+        "SELECT id, " + column_list(Derived::value_columns)
+        + " FROM " + Derived::table_name + " WHERE id = $1;";
+    return sql;
+}
+
+template<class Derived, class Row, class Summary>
+const std::string& SQLiteTable<Derived, Row, Summary>::insert_sql()
+{
+    static const std::string sql = [] {
+        std::string values;
+        for (std::size_t i = 1; i <= std::extent<decltype(Derived::value_columns)>::value; ++i)
+            values += (i > 1 ? ", $" : "$") + std::to_string(i);
+        return std::string("INSERT INTO ") + Derived::table_name
+            + " (" + column_list(Derived::value_columns) + ") VALUES (" + values + ");";
+    }();
+    return sql;
+}
+
+template<class Derived, class Row, class Summary>
+const std::string& SQLiteTable<Derived, Row, Summary>::update_sql()
+{
+    static const std::string sql = [] {
+        const std::size_t n = std::extent<decltype(Derived::value_columns)>::value;
+        std::string sql = std::string("UPDATE ") + Derived::table_name + " SET ";
+        for (std::size_t i = 0; i < n; ++i) {
+            if (i > 0)
+                sql += ", ";
+            sql += Derived::value_columns[i] + std::string(" = $") + std::to_string(i + 1);
+        }
+        return sql + " WHERE id = $" + std::to_string(n + 1) + ";";
+    }();
+    return sql;
+}
+
+template<class Derived, class Row, class Summary>
+const std::string& SQLiteTable<Derived, Row, Summary>::delete_sql()
+{
+    static const std::string sql =
+        std::string("DELETE FROM ") + Derived::table_name + " WHERE id = $1;";
+    return sql;
+}
+
+template class SQLiteTable<CardSQLiteTable, Card, CardSummary>;
+template class SQLiteTable<TopicSQLiteTable, Topic, Topic>;
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // CardSQLiteTable
 ////////////////////////////////////////////////////////////////////////////////
 
-CardSQLiteTable::CardSQLiteTable(sqlite3* db)
-: SQLiteTable(db) {}
+constexpr const char* CardSQLiteTable::table_name;
+constexpr const char* CardSQLiteTable::list_columns[];
+constexpr const char* CardSQLiteTable::value_columns[];
 
+std::atomic<unsigned long> CardSQLiteTable::s_version{0};
 
-std::string CardSQLiteTable::get_table_name() const
+CardSQLiteTable::CardSQLiteTable(SQLiteDatabase& db)
+: SQLiteTable(db) {}
+
+unsigned long CardSQLiteTable::version()
 {
-    return "card";
+    return s_version;
 }
 
-bool CardSQLiteTable::data_is_valid(const json& data) const
+void CardSQLiteTable::changed()
 {
-    // todo Check for correct type.
-    return data.find("title") != data.end() && data["title"] != ""
-        && data.find("question") != data.end() && data["question"] != "";
+    // Readers must not see the new version before the new data.
+    m_database.after_commit([] { ++s_version; });
 }
 
-SQLiteStatement CardSQLiteTable::insert_statement(const json& data) const
+bool CardSQLiteTable::search_json(std::string& out, beast::string_view terms,
+                                  std::size_t max_rows, std::size_t offset) const
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(INSERT INTO card
-                (title, question, answer, topic)
-                VALUES ($1, $2, $3, $4);
-            )RAW");
-
-    stmt.bind_text(1, data["title"]);
-    stmt.bind_text(2, data["question"]);
-    if (data.find("answer") != data.end())
-        stmt.bind_text(3, data["answer"]);
-    else
-        stmt.bind_null(3);
-    if (data.find("topic") != data.end())
-        stmt.bind_int(4, data["topic"]);
-    else
-        stmt.bind_int(4, 0);    // set default topic
-
-    return stmt;
+    // Quote every word, so user input can't be misread as FTS5 syntax
+    // (operators, column filters, unbalanced quotes).
+    std::string query;
+    while (!terms.empty()) {
+        auto begin = terms.find_first_not_of(" \t\r\n");
+        if (begin == beast::string_view::npos)
+            break;
+        terms.remove_prefix(begin);
+        auto end = std::min(terms.find_first_of(" \t\r\n"), terms.size());
+        if (!query.empty())
+            query += ' ';
+        query += '"';
+        for (char c : terms.substr(0, end)) {
+            if (c == '"')
+                query += '"';
+            query += c;
+        }
+        query += '"';
+        terms.remove_prefix(end);
+    }
+    if (query.empty())
+        throw std::invalid_argument("search: no search terms");
+    query += '*';
+
+    // One row more than requested tells whether there are more.
+    static const std::string sql =
+        R"RAW(SELECT card.id AS id, card.title AS title, card.topic AS topic,
+                    snippet(card_fts, -1, '[', ']', '...', 12) AS snippet
+                FROM card_fts JOIN card ON card.id = card_fts.rowid
+                WHERE card_fts MATCH $1
+                ORDER BY rank
+                LIMIT $2 OFFSET $3;)RAW";
+    SQLiteStatement stmt(m_db, m_stmt_cache, sql);
+    stmt.bind_text(1, query);
+    stmt.bind_int64(2, static_cast<sqlite3_int64>(max_rows) + 1);
+    stmt.bind_int64(3, static_cast<sqlite3_int64>(offset));
+
+    int last_id;
+    return write_rows_json(stmt, out, max_rows, last_id);
 }
 
-SQLiteStatement CardSQLiteTable::get_statement(
-    const std::unordered_map<std::string, std::string>& filter) const
+void CardSQLiteTable::get_many_json(std::string& out, const std::vector<int>& ids) const
 {
-    std::string str("SELECT id, title from card");
-    if (filter.find("topic") != filter.end())
-        str += " WHERE topic = " + filter.at("topic");  // TODO error checking
-    str += ";";
+    // The ids are bound as one JSON array, so lists of any length share
+    // one cached statement. Joining in the order of the array keeps the
+    // requested order; each id is a rowid lookup.
+    std::string id_array = "[";
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0)
+            id_array += ',';
+        id_array += std::to_string(ids[i]);
+    }
+    id_array += ']';
 
-    SQLiteStatement stmt(
-        m_db,
-        str);
+    static const std::string sql =
+        R"RAW(SELECT card.id AS id, title, question, answer, topic
+                FROM json_each($1) AS ids JOIN card ON card.id = ids.value
+                ORDER BY ids.key;)RAW";
+    SQLiteStatement stmt(m_db, m_stmt_cache, sql);
+    stmt.bind_text(1, id_array, SQLiteStatement::Lifetime::caller_owned);
 
-    return stmt;
+    int last_id;
+    write_rows_json(stmt, out, ids.size(), last_id);
 }
 
-SQLiteStatement CardSQLiteTable::get_one_statement(int id) const
+bool CardSQLiteTable::data_is_valid(const Card& card)
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(SELECT id, title, question, answer, topic
-                from card
-                WHERE id = $1;)RAW");
-    stmt.bind_int(1, id);
-    return stmt;
+    return !card.title.empty() && !card.question.empty();
 }
 
-SQLiteStatement CardSQLiteTable::update_statement(int id, const json& data) const
+void CardSQLiteTable::bind_values(SQLiteStatement& stmt, const Card& card)
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(UPDATE card
-                SET title = $1, question = $2, answer = $3, topic = $4
-                WHERE id = $5;
-            )RAW");
-
-    stmt.bind_text(1, data["title"]);
-    stmt.bind_text(2, data["question"]);
-    if (data.find("answer") != data.end())
-        stmt.bind_text(3, data["answer"]);
+    // `card` outlives the statement's execution, so SQLite doesn't need a copy.
+    const auto owned = SQLiteStatement::Lifetime::caller_owned;
+
+    stmt.bind_text(1, card.title, owned);
+    stmt.bind_text(2, card.question, owned);
+    if (card.has_answer)
+        stmt.bind_text(3, card.answer, owned);
     else
         stmt.bind_null(3);
-    if (data.find("topic") != data.end())
-        stmt.bind_int(4, data["topic"]);
-    else
-        stmt.bind_int(4, 0);    // set default topic
-    stmt.bind_int(5, id);
+    stmt.bind_int(4, card.topic);
+}
 
+SQLiteStatement CardSQLiteTable::get_statement(
+    const std::unordered_map<std::string, std::string>& filter) const
+{
+    // Filter values are bound as parameters, so every request
+    // shares the same cached statement.
+    if (filter.find("topic") == filter.end())
+        return SQLiteTable::get_statement(filter);
+
+    // Rows are ordered by id, so callers can page through them with
+    // "after_id". Both conditions are served by topicindex.
+    static const std::string sql =
+        list_sql() + " WHERE topic = $1 AND id > $2 ORDER BY id;";
+    SQLiteStatement stmt(m_db, m_stmt_cache, sql);
+    stmt.bind_int(1, std::stoi(filter.at("topic")));
+    auto after = filter.find("after_id");
+    stmt.bind_int(2, after != filter.end() ? std::stoi(after->second) : 0);
     return stmt;
 }
 
-
-json CardSQLiteTable::fetch_one_shallow(SQLiteStatement& stmt) const
+void CardSQLiteTable::read_summary(SQLiteStatement& stmt, CardSummary& card)
 {
-    json c;
-    c["id"] = stmt.column_int(0);
-    c["title"] = stmt.column_text(1);
-    return c;
+    card.id = stmt.column_int(0);
+    auto title = stmt.column_text_view(1);
+    card.title.assign(title.data(), title.size());
 }
 
-json CardSQLiteTable::fetch_one_detailed(SQLiteStatement& stmt) const
+void CardSQLiteTable::read_row(SQLiteStatement& stmt, Card& card)
 {
-    json card;
-
-    card["id"] = stmt.column_int(0);
-    card["title"] = stmt.column_text(1);
-    card["question"] = stmt.column_text(2);
-    try {
-        card["answer"] = stmt.column_text(3);
-    } catch (const SQLiteColumnNull&) {
-        // answer is NULL
-    }
-    card["topic"] = stmt.column_int(4);
-
-    return card;
+    card.id = stmt.column_int(0);
+    auto title = stmt.column_text_view(1);
+    card.title.assign(title.data(), title.size());
+    auto question = stmt.column_text_view(2);
+    card.question.assign(question.data(), question.size());
+    card.has_answer = !stmt.column_is_null(3);
+    auto answer = stmt.column_text_view(3);
+    card.answer.assign(answer.data(), answer.size());
+    card.topic = stmt.column_int(4);
 }
 
 
@@ -225,78 +462,54 @@ json CardSQLiteTable::fetch_one_detailed(SQLiteStatement& stmt) const
 // TopicSQLiteTable
 ////////////////////////////////////////////////////////////////////////////////
 
-TopicSQLiteTable::TopicSQLiteTable(sqlite3* db)
-: SQLiteTable(db) {}
+constexpr const char* TopicSQLiteTable::table_name;
+constexpr const char* TopicSQLiteTable::list_columns[];
+constexpr const char* TopicSQLiteTable::value_columns[];
 
-std::string TopicSQLiteTable::get_table_name() const
-{
-    return "topic";
-}
+std::atomic<unsigned long> TopicSQLiteTable::s_version{0};
 
-bool TopicSQLiteTable::data_is_valid(const json& data) const
-{
-    // todo Check for correct type.
-    return data.find("name") != data.end() && data["name"] != "";
-}
+TopicSQLiteTable::TopicSQLiteTable(SQLiteDatabase& db)
+: SQLiteTable(db) {}
 
-SQLiteStatement TopicSQLiteTable::insert_statement(const json& data) const
+unsigned long TopicSQLiteTable::version()
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(INSERT INTO topic (name) VALUES ($1);)RAW");
-    stmt.bind_text(1, data["name"]);
-    return stmt;
+    return s_version;
 }
 
-SQLiteStatement TopicSQLiteTable::get_statement(
-    const std::unordered_map<std::string, std::string>&) const
+void TopicSQLiteTable::changed()
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(SELECT id, name from topic;)RAW");
-    return stmt;
+    // Readers must not see the new version before the new data.
+    m_database.after_commit([] {
+        ++s_version;
+
+        // Deleting a topic moves its cards to the default topic.
+        ++CardSQLiteTable::s_version;
+    });
 }
 
-SQLiteStatement TopicSQLiteTable::get_one_statement(int id) const
+bool TopicSQLiteTable::data_is_valid(const Topic& topic)
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(SELECT id, name
-                from topic
-                WHERE id = $1;)RAW");
-    stmt.bind_int(1, id);
-    return stmt;
+    return !topic.name.empty();
 }
 
-SQLiteStatement TopicSQLiteTable::update_statement(int id, const json& data) const
+void TopicSQLiteTable::bind_values(SQLiteStatement& stmt, const Topic& topic)
 {
-    SQLiteStatement stmt(
-        m_db,
-        R"RAW(UPDATE topic SET name = $1 WHERE id = $2;)RAW");
-
-    stmt.bind_text(1, data["name"]);
-    stmt.bind_int(2, id);
+    // `topic` outlives the statement's execution, so SQLite doesn't need a copy.
+    const auto owned = SQLiteStatement::Lifetime::caller_owned;
 
-    return stmt;
+    stmt.bind_text(1, topic.name, owned);
 }
 
-
-json TopicSQLiteTable::fetch_one_shallow(SQLiteStatement& stmt) const
+void TopicSQLiteTable::read_summary(SQLiteStatement& stmt, Topic& topic)
 {
-    json c;
-    c["id"] = stmt.column_int(0);
-    c["name"] = stmt.column_text(1);
-    return c;
+    read_row(stmt, topic);
 }
 
-json TopicSQLiteTable::fetch_one_detailed(SQLiteStatement& stmt) const
+void TopicSQLiteTable::read_row(SQLiteStatement& stmt, Topic& topic)
 {
-    json topic;
-
-    topic["id"] = stmt.column_int(0);
-    topic["name"] = stmt.column_text(1);
-
-    return topic;
+    topic.id = stmt.column_int(0);
+    auto name = stmt.column_text_view(1);
+    topic.name.assign(name.data(), name.size());
 }
 
 }   // nerd
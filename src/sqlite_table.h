@@ -1,96 +1,183 @@
 #ifndef NERD_SQLITE_TABLE_H
 #define NERD_SQLITE_TABLE_H
 
+#include <atomic>
+#include <cstddef>
+#include <limits>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <json.hpp>
 #include <sqlite3.h>
 
 #include "names.h"
+#include "rows.h"
+#include "sqlite_database.h"
 #include "sqlite_statement.h"
 
 namespace nerd {
 
+// Operations common to all tables. The table itself is described at
+// compile time by `Derived` (CRTP), whose rows are `Row` and, as listed,
+// `Summary`. Derived provides
+//
+//   static constexpr const char* table_name;
+//   static constexpr const char* list_columns[];   // listed by get(), after id
+//   static constexpr const char* value_columns[];  // set by insert() and update()
+//
+//   static bool data_is_valid(const Row& row);
+//   // Bind `row` to the parameters $1, $2, ... of value_columns.
+//   static void bind_values(SQLiteStatement& stmt, const Row& row);
+//   static void read_summary(SQLiteStatement& stmt, Summary& row); // id, list_columns
+//   static void read_row(SQLiteStatement& stmt, Row& row);         // id, value_columns
+//
+//   // Called after every successful insert, update and remove.
+//   void changed();
+//
+// and may hide get_statement() to support filters. The SQL text of each
+// table is generated once; no call is virtual.
+template<class Derived, class Row, class Summary>
 class SQLiteTable {
 protected:
-    SQLiteTable(sqlite3* db);
+    SQLiteTable(SQLiteDatabase& db);
 
 public:
     // Returns id of newly inserted object.
     // Throws if object can't be inserted.
-    int insert(const json& data);
+    // The id of `row` is ignored.
+    int insert(const Row& row);
+
+    // Insert all `rows` with a single prepared
+    // statement. Returns the ids of the first and the last inserted
+    // object; the ids in between belong to the others, in order.
+    // Throws without inserting anything if an object is invalid.
+    // Should run inside a transaction.
+    std::pair<int, int> insert_many(const std::vector<Row>& rows);
 
     // Return all objects from database.
-    // todo Add filter.
-    json get(const std::unordered_map<std::string, std::string>& filter=std::unordered_map<std::string, std::string>()) const;
-    
+    std::vector<Summary> get(const std::unordered_map<std::string, std::string>& filter=std::unordered_map<std::string, std::string>()) const;
+
+    // Same as get(), but append the JSON array of objects to `out`
+    // row by row instead of building a vector.
+    // At most `max_rows` objects are appended. If there are more, the id
+    // of the last appended object is returned as cursor, otherwise -1.
+    int write_json(std::string& out,
+                   const std::unordered_map<std::string, std::string>& filter=std::unordered_map<std::string, std::string>(),
+                   std::size_t max_rows=std::numeric_limits<std::size_t>::max()) const;
+
     // Return all details from object with given id.
-    json get_one(int id) const;
+    // Throws std::out_of_range if there is none.
+    Row get_one(int id) const;
 
-    // Update object with given id.
-    void update(int id, const json& data);
+    // Update object with given id. The id of `row` is ignored.
+    void update(int id, const Row& row);
 
     // Delete object with given id.
     void remove(int id);
 
-private:    // or protected??
-    virtual std::string get_table_name() const = 0;
-    virtual bool data_is_valid(const json& data) const = 0;
-
-    virtual SQLiteStatement insert_statement(const json& data) const = 0;
-    // TODO: Use map of arbitrary value types.
-    virtual SQLiteStatement get_statement(
-        const std::unordered_map<std::string, std::string>& filter) const = 0;
-    virtual SQLiteStatement get_one_statement(int id) const = 0;
-    virtual SQLiteStatement update_statement(int id, const json& data) const = 0;
-    SQLiteStatement delete_statement(int id) const;
-
-    virtual json fetch_one_shallow(SQLiteStatement& stmt) const = 0;
-    virtual json fetch_one_detailed(SQLiteStatement& stmt) const = 0;
-
 protected:
+    // Unfiltered statement for get() and write_json().
+    SQLiteStatement get_statement(
+        const std::unordered_map<std::string, std::string>& filter) const;
+
+    // Append the rows of `stmt` to `out` as a JSON array of objects
+    // keyed by column name; the first column has to be the id.
+    // At most `max_rows` rows are appended. Returns true if there are
+    // more, with the id of the last appended row in `last_id`.
+    bool write_rows_json(SQLiteStatement& stmt, std::string& out,
+                         std::size_t max_rows, int& last_id) const;
+
+    // SQL generated from the description of Derived.
+    // "SELECT id, <list_columns> FROM <table_name>", without ';'.
+    static const std::string& list_sql();
+    static const std::string& get_one_sql();
+    static const std::string& insert_sql();
+    static const std::string& update_sql();
+    static const std::string& delete_sql();
+
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+    Derived& derived() { return static_cast<Derived&>(*this); }
+
+    SQLiteDatabase& m_database;
     sqlite3* m_db;
+    SQLiteStatementCache& m_stmt_cache;
 };
 
-class CardSQLiteTable : public SQLiteTable {
+class CardSQLiteTable : public SQLiteTable<CardSQLiteTable, Card, CardSummary> {
 public:
-    CardSQLiteTable(sqlite3* db);
+    CardSQLiteTable(SQLiteDatabase& db);
+
+    // Number of changes to the card table made through any
+    // CardSQLiteTable since the process started.
+    static unsigned long version();
+
+    // Full-text search in title, question and answer. Every word of
+    // `terms` has to occur, the last one may be the prefix of a word.
+    // Appends the matches as JSON array, best first, with id, title,
+    // topic and a snippet of the matching text, skipping the first
+    // `offset` matches. At most `max_rows` matches are appended.
+    // Returns true if there are more.
+    bool search_json(std::string& out, beast::string_view terms,
+                     std::size_t max_rows, std::size_t offset) const;
+
+    // Append the details of the cards with the given ids as JSON array,
+    // in the order of `ids`. Unknown ids are left out. A card without an
+    // answer has "answer":null.
+    void get_many_json(std::string& out, const std::vector<int>& ids) const;
 
 private:
-    std::string get_table_name() const override;
+    friend class SQLiteTable<CardSQLiteTable, Card, CardSummary>;
+
+    static constexpr const char* table_name = "card";
+    static constexpr const char* list_columns[] = {"title"};
+    static constexpr const char* value_columns[] = {"title", "question", "answer", "topic"};
 
-    bool data_is_valid(const json& data) const override;
+    static bool data_is_valid(const Card& card);
+    static void bind_values(SQLiteStatement& stmt, const Card& card);
+    static void read_summary(SQLiteStatement& stmt, CardSummary& card);
+    static void read_row(SQLiteStatement& stmt, Card& card);
 
-    SQLiteStatement insert_statement(const json& data) const override;
+    // Supports the filters "topic" and "after_id".
     SQLiteStatement get_statement(
-        const std::unordered_map<std::string, std::string>& filter) const override;
-    SQLiteStatement get_one_statement(int id) const override;
-    SQLiteStatement update_statement(int id, const json& data) const override;
+        const std::unordered_map<std::string, std::string>& filter) const;
 
-    json fetch_one_shallow(SQLiteStatement& stmt) const override;
-    json fetch_one_detailed(SQLiteStatement& stmt) const override;
+    void changed();
+
+    // Topic changes can modify cards.
+    friend class TopicSQLiteTable;
+    static std::atomic<unsigned long> s_version;
 };
-    
-class TopicSQLiteTable : public SQLiteTable {
+
+class TopicSQLiteTable : public SQLiteTable<TopicSQLiteTable, Topic, Topic> {
 public:
-    TopicSQLiteTable(sqlite3* db);
+    TopicSQLiteTable(SQLiteDatabase& db);
+
+    // Number of changes to the topic table made through any
+    // TopicSQLiteTable since the process started.
+    static unsigned long version();
 
 private:
-    std::string get_table_name() const override;
+    friend class SQLiteTable<TopicSQLiteTable, Topic, Topic>;
 
-    bool data_is_valid(const json& data) const override;
+    static constexpr const char* table_name = "topic";
+    static constexpr const char* list_columns[] = {"name"};
+    static constexpr const char* value_columns[] = {"name"};
 
-    SQLiteStatement insert_statement(const json& data) const override;
-    SQLiteStatement get_statement(
-        const std::unordered_map<std::string, std::string>& filter) const override;
-    SQLiteStatement get_one_statement(int id) const override;
-    SQLiteStatement update_statement(int id, const json& data) const override;
+    static bool data_is_valid(const Topic& topic);
+    static void bind_values(SQLiteStatement& stmt, const Topic& topic);
+    static void read_summary(SQLiteStatement& stmt, Topic& topic);
+    static void read_row(SQLiteStatement& stmt, Topic& topic);
 
-    json fetch_one_shallow(SQLiteStatement& stmt) const override;
-    json fetch_one_detailed(SQLiteStatement& stmt) const override;
+    void changed();
+
+    static std::atomic<unsigned long> s_version;
 };
-    
+
+extern template class SQLiteTable<CardSQLiteTable, Card, CardSummary>;
+extern template class SQLiteTable<TopicSQLiteTable, Topic, Topic>;
+
 }   // nerd
 
 #endif  // NERD_SQLITE_TABLE_H
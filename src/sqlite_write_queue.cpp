@@ -0,0 +1,122 @@
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+#include "sqlite_write_queue.h"
+
+namespace nerd {
+
+SQLiteWriteQueue::SQLiteWriteQueue(SQLiteConnectionPool& pool,
+                                   std::size_t max_batch,
+                                   std::chrono::microseconds max_delay)
+    : m_pool(pool)
+    , m_max_batch{max_batch > 0 ? max_batch : 1}
+    , m_max_delay{max_delay}
+    , m_stopping{false}
+    , m_thread{&SQLiteWriteQueue::run, this}
+{
+}
+
+SQLiteWriteQueue::~SQLiteWriteQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void SQLiteWriteQueue::submit(Mutation mutation, Completion done)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(Entry{std::move(mutation), std::move(done)});
+    }
+    m_cond.notify_one();
+}
+
+void SQLiteWriteQueue::run()
+{
+    std::deque<Entry> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;     // stopping and drained
+
+            // Give further mutations a chance to join the batch.
+            if (m_max_delay.count() > 0 && m_queue.size() < m_max_batch && !m_stopping) {
+                auto deadline = std::chrono::steady_clock::now() + m_max_delay;
+                m_cond.wait_until(lock, deadline, [this] {
+                    return m_stopping || m_queue.size() >= m_max_batch;
+                });
+            }
+
+            while (!m_queue.empty() && batch.size() < m_max_batch) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+
+        commit(batch);
+        batch.clear();
+    }
+}
+
+void SQLiteWriteQueue::commit(std::deque<Entry>& batch)
+{
+    std::vector<std::exception_ptr> errors(batch.size());
+    auto db = m_pool.writer();
+    bool committed = false;
+    try {
+        db->execute("BEGIN IMMEDIATE;");
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            // A savepoint per mutation, so a failing one
+            // doesn't take the rest of the batch with it.
+            db->execute("SAVEPOINT mutation;");
+            try {
+                batch[i].mutation(*db);
+                db->execute("RELEASE mutation;");
+            } catch (...) {
+                errors[i] = std::current_exception();
+                db->execute("ROLLBACK TO mutation;");
+                db->execute("RELEASE mutation;");
+            }
+        }
+        db->execute("COMMIT;");
+        committed = true;
+    } catch (...) {
+        // BEGIN, a savepoint or COMMIT failed: nothing of the batch is
+        // durable. End the transaction if it is still open, or every
+        // later batch would fail at BEGIN.
+        auto error = std::current_exception();
+        for (auto& e : errors)
+            if (!e)
+                e = error;
+        if (!sqlite3_get_autocommit(db->data())) {
+            try {
+                db->execute("ROLLBACK;");
+            } catch (const std::exception& e) {
+                std::cerr << "write queue: rollback failed: " << e.what() << "\n";
+            }
+        }
+        db->discard_after_commit();
+    }
+    if (committed)
+        db->run_after_commit();
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        try {
+            batch[i].done(errors[i]);
+        } catch (const std::exception& e) {
+            std::cerr << "write completion: " << e.what() << "\n";
+        }
+    }
+}
+
+}   // nerd
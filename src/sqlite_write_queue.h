@@ -0,0 +1,72 @@
+#ifndef NERD_SQLITE_WRITE_QUEUE_H
+#define NERD_SQLITE_WRITE_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "sqlite_connection_pool.h"
+#include "sqlite_database.h"
+
+namespace nerd {
+
+// Runs mutations on the writer connection in a dedicated thread and
+// commits them in batches, so a burst of writes costs one transaction
+// (and one sync) instead of one per mutation.
+class SQLiteWriteQueue {
+public:
+    // Changes the database. Exceptions roll back this mutation only.
+    using Mutation = std::function<void(SQLiteDatabase&)>;
+
+    // Called on the writer thread once the batch containing the mutation
+    // is committed. `error` is null on success.
+    using Completion = std::function<void(std::exception_ptr error)>;
+
+    // A batch is committed when it holds `max_batch` mutations or when
+    // `max_delay` has passed since its first mutation arrived, whichever
+    // comes first. With a zero delay a batch holds the mutations that
+    // queued up while the previous batch was committed.
+    SQLiteWriteQueue(SQLiteConnectionPool& pool,
+                     std::size_t max_batch,
+                     std::chrono::microseconds max_delay);
+
+    SQLiteWriteQueue(const SQLiteWriteQueue&) = delete;
+    SQLiteWriteQueue& operator=(const SQLiteWriteQueue&) = delete;
+
+    // Commits all queued mutations and stops the writer thread.
+    ~SQLiteWriteQueue();
+
+    // Queue a mutation. Thread-safe.
+    void submit(Mutation mutation, Completion done);
+
+private:
+    struct Entry {
+        Mutation mutation;
+        Completion done;
+    };
+
+    void run();
+
+    // Execute and commit one batch on the writer connection.
+    void commit(std::deque<Entry>& batch);
+
+    SQLiteConnectionPool& m_pool;
+    const std::size_t m_max_batch;
+    const std::chrono::microseconds m_max_delay;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Entry> m_queue;
+    bool m_stopping;
+
+    std::thread m_thread;   // last, so it starts after everything else
+};
+
+}   // nerd
+
+#endif  // NERD_SQLITE_WRITE_QUEUE_H
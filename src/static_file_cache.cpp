@@ -0,0 +1,436 @@
+#include <algorithm>    // sort, lower_bound
+#include <cstdint>
+#include <cstdio>       // snprintf
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include "static_file_cache.h"
+
+namespace {
+
+// Strong ETag from a 64-bit FNV-1a hash of the contents.
+std::string make_etag(const std::string& data)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char buf[24];
+    std::snprintf(buf, sizeof buf, "\"%016llx\"",
+                  static_cast<unsigned long long>(hash));
+    return buf;
+}
+
+// Size and modification time of a file as strong entity tag.
+std::string stat_etag(const struct stat& st)
+{
+    unsigned long long mtime_ns = static_cast<unsigned long long>(st.st_mtime) * 1000000000ull;
+#ifdef __linux__
+    mtime_ns += st.st_mtim.tv_nsec;
+#endif
+    char buf[48];
+    std::snprintf(buf, sizeof buf, "\"%llx-%llx\"",
+                  static_cast<unsigned long long>(st.st_size), mtime_ns);
+    return buf;
+}
+
+// Read a whole file. Returns false if it can't be read.
+bool read_file(const std::string& path, std::string& data)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+// Types that are worth compressing.
+bool is_text(beast::string_view content_type)
+{
+    return content_type.starts_with("text/")
+        || content_type == "application/javascript"
+        || content_type == "application/json"
+        || content_type == "application/xml"
+        || content_type == "image/svg+xml";
+}
+
+// Compress `data` with the best compression, for files compressed once.
+// Return false on failure.
+bool gzip(const std::string& data, std::string& out)
+{
+    z_stream zs{};
+    // 15 window bits, +16 for a gzip header and trailer.
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, data.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    const int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+bool brotli(const std::string& data, std::string& out)
+{
+    std::size_t size = BrotliEncoderMaxCompressedSize(data.size());
+    if (size == 0)
+        return false;
+    out.resize(size);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               data.size(), reinterpret_cast<const uint8_t*>(data.data()),
+                               &size, reinterpret_cast<uint8_t*>(&out[0])))
+        return false;
+    out.resize(size);
+    return true;
+}
+
+}
+
+namespace nerd {
+
+beast::string_view mime_type(beast::string_view path)
+{
+    using beast::iequals;
+    auto const ext = [&path]
+    {
+        auto const pos = path.rfind(".");
+        if (pos == beast::string_view::npos)
+            return beast::string_view{};
+        return path.substr(pos);
+    }();
+    if (iequals(ext, ".htm"))  return "text/html";
+    if (iequals(ext, ".html")) return "text/html";
+    if (iequals(ext, ".php"))  return "text/html";
+    if (iequals(ext, ".css"))  return "text/css";
+    if (iequals(ext, ".txt"))  return "text/plain";
+    if (iequals(ext, ".js"))   return "application/javascript";
+    if (iequals(ext, ".json")) return "application/json";
+    if (iequals(ext, ".xml"))  return "application/xml";
+    if (iequals(ext, ".swf"))  return "application/x-shockwave-flash";
+    if (iequals(ext, ".flv"))  return "video/x-flv";
+    if (iequals(ext, ".png"))  return "image/png";
+    if (iequals(ext, ".jpe"))  return "image/jpeg";
+    if (iequals(ext, ".jpeg")) return "image/jpeg";
+    if (iequals(ext, ".jpg"))  return "image/jpeg";
+    if (iequals(ext, ".gif"))  return "image/gif";
+    if (iequals(ext, ".bmp"))  return "image/bmp";
+    if (iequals(ext, ".ico"))  return "image/vnd.microsoft.icon";
+    if (iequals(ext, ".tiff")) return "image/tiff";
+    if (iequals(ext, ".tif"))  return "image/tiff";
+    if (iequals(ext, ".svg"))  return "image/svg+xml";
+    if (iequals(ext, ".svgz")) return "image/svg+xml";
+    return "application/text";
+}
+
+std::string file_etag(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return std::string();
+    return stat_etag(st);
+}
+
+ByteRange parse_range(beast::string_view range, std::uint64_t size,
+                      std::uint64_t& offset, std::uint64_t& length)
+{
+    // Digits only, without overflow. Returns false if there are none.
+    auto parse_number = [](beast::string_view s, std::uint64_t& value) {
+        if (s.empty() || s.size() > 19)
+            return false;
+        value = 0;
+        for (char c : s) {
+            if (c < '0' || c > '9')
+                return false;
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    };
+
+    const beast::string_view unit = "bytes=";
+    if (range.size() <= unit.size() || !beast::iequals(range.substr(0, unit.size()), unit))
+        return ByteRange::none;
+    range.remove_prefix(unit.size());
+    const auto dash = range.find('-');
+    if (dash == beast::string_view::npos || range.find(',') != beast::string_view::npos)
+        return ByteRange::none;
+    const auto first_str = range.substr(0, dash);
+    const auto last_str = range.substr(dash + 1);
+
+    std::uint64_t first, last;
+    if (first_str.empty()) {
+        // Suffix: the last `last` bytes.
+        if (!parse_number(last_str, last))
+            return ByteRange::none;
+        if (last == 0 || size == 0)
+            return ByteRange::unsatisfiable;
+        length = std::min(last, size);
+        offset = size - length;
+        return ByteRange::satisfiable;
+    }
+    if (!parse_number(first_str, first))
+        return ByteRange::none;
+    if (last_str.empty())
+        last = size - 1;
+    else if (!parse_number(last_str, last) || last < first)
+        return ByteRange::none;
+    if (first >= size)
+        return ByteRange::unsatisfiable;
+    offset = first;
+    length = std::min(last, size - 1) - first + 1;
+    return ByteRange::satisfiable;
+}
+
+bool accepts_encoding(beast::string_view accept_encoding, beast::string_view coding)
+{
+    // An explicit entry for the coding overrides "*".
+    int explicit_ok = -1;
+    int any_ok = -1;
+    while (!accept_encoding.empty()) {
+        auto end = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, end);
+        accept_encoding.remove_prefix(end == beast::string_view::npos
+                                      ? accept_encoding.size() : end + 1);
+
+        // "gzip;q=0.5": the coding is acceptable unless q is 0.
+        auto semicolon = item.find(';');
+        auto name = item.substr(0, semicolon);
+        bool ok = true;
+        if (semicolon != beast::string_view::npos) {
+            auto params = item.substr(semicolon + 1);
+            auto q = params.find("q=");
+            if (q != beast::string_view::npos) {
+                auto value = params.substr(q + 2);
+                value = value.substr(0, value.find_first_not_of("0123456789."));
+                ok = value.find_first_not_of("0.") != beast::string_view::npos;
+            }
+        }
+
+        auto first = name.find_first_not_of(" \t");
+        auto last = name.find_last_not_of(" \t");
+        if (first == beast::string_view::npos)
+            continue;
+        name = name.substr(first, last - first + 1);
+        if (beast::iequals(name, coding))
+            explicit_ok = ok;
+        else if (name == "*")
+            any_ok = ok;
+    }
+    return explicit_ok >= 0 ? explicit_ok == 1 : any_ok == 1;
+}
+
+const CachedFile::Encoded* CachedFile::best_encoding(beast::string_view accept_encoding) const
+{
+    for (const auto& e : encoded) {
+        if (accepts_encoding(accept_encoding, e.coding))
+            return &e;
+    }
+    return nullptr;
+}
+
+
+StaticFileCache::StaticFileCache(std::string doc_root, std::size_t max_file_size)
+    : m_doc_root{std::move(doc_root)}
+    , m_max_file_size{max_file_size}
+    , m_reload{false}
+    , m_stopping{false}
+{
+    if (!m_doc_root.empty() && m_doc_root.back() == '/')
+        m_doc_root.pop_back();
+    load();
+}
+
+StaticFileCache::~StaticFileCache()
+{
+    if (m_loader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cond.notify_one();
+        m_loader.join();
+    }
+}
+
+std::shared_ptr<const CachedFile> StaticFileCache::find(beast::string_view target) const
+{
+    auto files = std::atomic_load(&m_files);
+    auto it = std::lower_bound(
+        files->begin(), files->end(), target,
+        [](const Files::value_type& entry, beast::string_view t) {
+            return beast::string_view(entry.first) < t;
+        });
+    if (it == files->end() || beast::string_view(it->first) != target)
+        return nullptr;
+    return it->second;
+}
+
+void StaticFileCache::watch(net::io_context& ioctx)
+{
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "inotify_init1 failed, static files won't be refreshed\n";
+        return;
+    }
+    m_inotify.reset(new net::posix::stream_descriptor(ioctx, fd));
+
+    // Loading again registers a watch for every directory. All files
+    // are unchanged, so none of them is read or compressed again.
+    load();
+    m_loader = std::thread(&StaticFileCache::run_loader, this);
+    do_read_events();
+#else
+    (void)ioctx;
+#endif
+}
+
+void StaticFileCache::run_loader()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_stopping || m_reload; });
+        if (m_stopping)
+            return;
+        m_reload = false;
+        lock.unlock();
+        load();
+        lock.lock();
+    }
+}
+
+void StaticFileCache::load()
+{
+    std::shared_ptr<Files> files = std::make_shared<Files>();
+    load_dir("/", *files);
+    std::sort(files->begin(), files->end());
+    std::atomic_store(&m_files, std::shared_ptr<const Files>(std::move(files)));
+}
+
+void StaticFileCache::load_dir(const std::string& dir, Files& files)
+{
+    const std::string path = m_doc_root + dir;
+    DIR* d = opendir(path.c_str());
+    if (!d)
+        return;
+
+#ifdef __linux__
+    if (m_inotify)
+        inotify_add_watch(m_inotify->native_handle(), path.c_str(),
+                          IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                          | IN_MOVED_FROM | IN_MOVED_TO);
+#endif
+
+    while (dirent* entry = readdir(d)) {
+        const std::string name(entry->d_name);
+        if (name == "." || name == "..")
+            continue;
+
+        struct stat st;
+        if (stat((path + name).c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode)) {
+            load_dir(dir + name + "/", files);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)
+            || static_cast<std::size_t>(st.st_size) > m_max_file_size)
+            continue;
+
+        // Precompressed siblings first, then compress text ourselves.
+        const struct {
+            const char* coding;
+            const char* suffix;
+            bool (*compress)(const std::string&, std::string&);
+        } codings[] = {
+            {"br", ".br", brotli},
+            {"gzip", ".gz", gzip}
+        };
+
+        std::string version = stat_etag(st);
+        for (const auto& c : codings) {
+            struct stat sibling;
+            if (stat((path + name + c.suffix).c_str(), &sibling) == 0)
+                version += stat_etag(sibling);
+            version += ';';
+        }
+        auto old = m_files ? find(dir + name) : nullptr;
+        if (old && old->version == version) {
+            files.emplace_back(dir + name, old);
+            if (name == "index.html")
+                files.emplace_back(dir, old);
+            continue;
+        }
+
+        auto file = std::make_shared<CachedFile>();
+        if (!read_file(path + name, file->body))
+            continue;
+        file->content_type = std::string(mime_type(name));
+        file->etag = make_etag(file->body);
+        file->version = std::move(version);
+
+        for (const auto& c : codings) {
+            CachedFile::Encoded e;
+            e.coding = c.coding;
+            if (!read_file(path + name + c.suffix, e.body)
+                && !(is_text(file->content_type) && c.compress(file->body, e.body)))
+                continue;
+            if (e.body.size() >= file->body.size())
+                continue;
+            e.etag = make_etag(e.body);
+            file->encoded.push_back(std::move(e));
+        }
+        std::sort(file->encoded.begin(), file->encoded.end(),
+                  [](const CachedFile::Encoded& a, const CachedFile::Encoded& b) {
+                      return a.body.size() < b.body.size();
+                  });
+
+        files.emplace_back(dir + name, file);
+        if (name == "index.html")
+            files.emplace_back(dir, file);
+    }
+    closedir(d);
+}
+
+void StaticFileCache::do_read_events()
+{
+    m_inotify->async_read_some(
+        net::buffer(m_events),
+        [this](beast::error_code ec, std::size_t) {
+            if (ec) {
+                if (ec != net::error::operation_aborted)
+                    std::cerr << "inotify: " << ec.message() << "\n";
+                return;
+            }
+
+            // Any change reloads the doc root, but only changed files
+            // are read again. Compressing them takes a while, so it's
+            // left to the loader thread.
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_reload = true;
+            }
+            m_cond.notify_one();
+            do_read_events();
+        });
+}
+
+}   // nerd
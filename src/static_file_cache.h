@@ -0,0 +1,232 @@
+#ifndef NERD_STATIC_FILE_CACHE_H
+#define NERD_STATIC_FILE_CACHE_H
+
+#include <algorithm>    // min
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/optional.hpp>
+
+#include "names.h"
+
+namespace nerd {
+
+// Return a reasonable mime type based on the extension of a file.
+beast::string_view mime_type(beast::string_view path);
+
+// Strong entity tag of an open file from its size and modification
+// time, for files that aren't cached. Empty if fstat() fails.
+std::string file_etag(int fd);
+
+// Result of parse_range().
+enum class ByteRange {
+    none,           // no or unsupported Range header: send everything
+    satisfiable,
+    unsatisfiable   // 416 Range Not Satisfiable
+};
+
+// Parse the value of a Range header for a file of `size` bytes.
+// Only a single range of bytes ("bytes=0-99", "bytes=100-",
+// "bytes=-100") is supported; other valid forms return none.
+ByteRange parse_range(beast::string_view range, std::uint64_t size,
+                      std::uint64_t& offset, std::uint64_t& length);
+
+// Return true if the value of an Accept-Encoding header allows the
+// content coding `coding` (e.g. "gzip"), explicitly or with "*".
+bool accepts_encoding(beast::string_view accept_encoding, beast::string_view coding);
+
+// A file of the doc root, loaded into memory together with
+// the header values of its response.
+struct CachedFile {
+    // The file compressed with a content coding.
+    struct Encoded {
+        std::string coding;     // value of Content-Encoding
+        std::string body;
+        std::string etag;
+    };
+
+    std::string body;
+    std::string content_type;
+    std::string etag;
+
+    // Size and modification time of the file and its precompressed
+    // siblings when loaded. Reloads keep the file while it's unchanged.
+    std::string version;
+
+    // Only encodings smaller than body, smallest first. Responses of
+    // files with encodings vary by Accept-Encoding.
+    std::vector<Encoded> encoded;
+
+    // The smallest encoding allowed by an Accept-Encoding header,
+    // or nullptr to send the body as it is.
+    const Encoded* best_encoding(beast::string_view accept_encoding) const;
+};
+
+// HTTP body that refers to the body of a cached file, or of one of its
+// encodings, instead of copying it. Shares ownership of the file.
+struct CachedFileBody {
+    using value_type = std::shared_ptr<const std::string>;
+
+    static std::uint64_t size(const value_type& body)
+    {
+        return body->size();
+    }
+
+    class writer {
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, const value_type& body)
+            : m_body(body)
+        {
+        }
+
+        void init(beast::error_code& ec)
+        {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(beast::error_code& ec)
+        {
+            ec = {};
+            return {{{m_body->data(), m_body->size()}, false}};
+        }
+
+    private:
+        const value_type& m_body;
+    };
+};
+
+// HTTP body of `size` bytes of an open file, starting at `offset`.
+// The writer reads the file in chunks; on Linux the server sends these
+// bodies with sendfile() instead, see HttpServer::Session.
+struct FileRangeBody {
+    struct value_type {
+        beast::file file;
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+    };
+
+    static std::uint64_t size(const value_type& body)
+    {
+        return body.size;
+    }
+
+    class writer {
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, value_type& body)
+            : m_body(body)
+            , m_remaining(body.size)
+        {
+        }
+
+        void init(beast::error_code& ec)
+        {
+            m_body.file.seek(m_body.offset, ec);
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(beast::error_code& ec)
+        {
+            const auto amount = std::min<std::uint64_t>(m_remaining, sizeof m_buf);
+            if (amount == 0) {
+                ec = {};
+                return boost::none;
+            }
+            const auto n = m_body.file.read(m_buf, amount, ec);
+            if (ec)
+                return boost::none;
+            if (n == 0) {
+                ec = http::error::short_read;   // file got shorter
+                return boost::none;
+            }
+            m_remaining -= n;
+            return {{{m_buf, n}, m_remaining > 0}};
+        }
+
+    private:
+        value_type& m_body;
+        std::uint64_t m_remaining;
+        char m_buf[16 << 10];
+    };
+};
+
+// In-memory copy of all files below the doc root up to a maximum size.
+// The cache can keep itself up to date with inotify; lookups never block
+// on a reload, they see either the old or the new set of files.
+// Files get brotli and gzip encodings when loaded: "<file>.br" and
+// "<file>.gz" next to them if there are, otherwise text files are
+// compressed once, so no request pays for compression. A reload only
+// reads and compresses files that changed.
+class StaticFileCache {
+public:
+    StaticFileCache(std::string doc_root, std::size_t max_file_size);
+
+    StaticFileCache(const StaticFileCache&) = delete;
+    StaticFileCache& operator=(const StaticFileCache&) = delete;
+
+    ~StaticFileCache();
+
+    // Return the file for a request target like "/app.js" or nullptr.
+    // A directory target ending in '/' maps to its index.html.
+    std::shared_ptr<const CachedFile> find(beast::string_view target) const;
+
+    // Reload the doc root whenever something in it changes. The inotify
+    // events are read on the given io_context, the reloads run on a
+    // thread of the cache. No-op outside of Linux.
+    void watch(net::io_context& ioctx);
+
+private:
+    // Sorted by request path, for lookups with a string_view.
+    using Files = std::vector<std::pair<std::string, std::shared_ptr<const CachedFile>>>;
+
+    // Read the doc root and replace m_files. Unchanged files
+    // are taken over from the current m_files.
+    void load();
+
+    // Add the files of directory `dir` (relative to the doc root,
+    // starting and ending with '/') and its subdirectories.
+    void load_dir(const std::string& dir, Files& files);
+
+    void do_read_events();
+
+    // Body of m_loader: reload whenever m_reload is set.
+    void run_loader();
+
+    std::string m_doc_root;
+    std::size_t m_max_file_size;
+    std::shared_ptr<const Files> m_files;   // accessed with std::atomic_load/store
+
+    // inotify
+    std::unique_ptr<net::posix::stream_descriptor> m_inotify;
+    std::array<char, 4096> m_events;
+
+    // Reloads requested by inotify events; events that arrive during
+    // a reload are handled by one more reload.
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_reload;
+    bool m_stopping;
+    std::thread m_loader;
+};
+
+}   // nerd
+
+#endif  // NERD_STATIC_FILE_CACHE_H